@@ -0,0 +1,581 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Throughput benchmark of gzdec. Synthetic corpora are generated and
+ * compressed in memory, then decoded by appsrc ! gzdec ! appsink, cut in
+ * buffers of several sizes. Every run reports the decoded MB/s, the input
+ * buffers per second, the peak RSS and where the CPU time went, and checks
+ * the output against the corpus */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "gstgzdeczlib.h"
+
+#define DEFAULT_SIZE    16
+#define DEFAULT_BLOCKS  "4096,65536,1048576"
+#define DEFAULT_REPEAT  1
+
+typedef struct
+{
+  const gchar *name;
+  void (*append) (GString * out, guint64 * rng);
+} Corpus;
+
+typedef struct
+{
+  const gchar *name;
+  GBytes *(*compress) (const guint8 * data, gsize size);
+  const gchar *props;           /* gzdec properties */
+} Backend;
+
+/* xorshift64*, the corpora must be the same on every host */
+static guint32
+rng_next (guint64 * rng)
+{
+  *rng ^= *rng >> 12;
+  *rng ^= *rng << 25;
+  *rng ^= *rng >> 27;
+  return (*rng * G_GUINT64_CONSTANT (2685821657736338717)) >> 32;
+}
+
+static const gchar *words[] = {
+  "request", "session", "user", "cache", "miss", "hit", "timeout", "retry",
+  "connection", "closed", "opened", "query", "index", "shard", "replica",
+  "commit", "flush", "segment", "upload", "download", "auth", "token"
+};
+
+static const gchar *levels[] = { "DEBUG", "INFO", "INFO", "INFO", "WARN",
+  "ERROR"
+};
+
+/* Service log lines */
+static void
+append_text (GString * out, guint64 * rng)
+{
+  static guint64 ms = 0;
+  guint i, n;
+
+  ms += rng_next (rng) % 50;
+  g_string_append_printf (out, "2021-06-%02u %02u:%02u:%02u.%03u %-5s "
+      "[worker-%u] ", (guint) (1 + ms / 86400000 % 28),
+      (guint) (ms / 3600000 % 24), (guint) (ms / 60000 % 60),
+      (guint) (ms / 1000 % 60), (guint) (ms % 1000),
+      levels[rng_next (rng) % G_N_ELEMENTS (levels)], rng_next (rng) % 16);
+  n = 3 + rng_next (rng) % 6;
+  for (i = 0; i < n; i++)
+    g_string_append_printf (out, "%s ",
+        words[rng_next (rng) % G_N_ELEMENTS (words)]);
+  g_string_append_printf (out, "id=%u took=%ums\n", rng_next (rng),
+      rng_next (rng) % 2000);
+}
+
+/* Event records, one JSON object per line */
+static void
+append_json (GString * out, guint64 * rng)
+{
+  static guint id = 0;
+
+  g_string_append_printf (out, "{\"id\":%u,\"user\":\"user%u\","
+      "\"event\":\"%s\",\"tags\":[\"%s\",\"%s\"],\"value\":%u.%02u,"
+      "\"ok\":%s}\n", id++, rng_next (rng) % 10000,
+      words[rng_next (rng) % G_N_ELEMENTS (words)],
+      words[rng_next (rng) % G_N_ELEMENTS (words)],
+      words[rng_next (rng) % G_N_ELEMENTS (words)],
+      rng_next (rng) % 1000, rng_next (rng) % 100,
+      rng_next (rng) % 8 ? "true" : "false");
+}
+
+/* Sensor samples: a timestamp and slowly drifting 16 bit channels */
+static void
+append_binary (GString * out, guint64 * rng)
+{
+  static guint64 ts = 0;
+  static gint16 channels[12];
+  guint8 record[8 + sizeof (channels)];
+  guint i;
+
+  ts += 1000 + rng_next (rng) % 8;
+  GST_WRITE_UINT64_LE (record, ts);
+  for (i = 0; i < G_N_ELEMENTS (channels); i++) {
+    channels[i] += (gint) (rng_next (rng) % 7) - 3;
+    GST_WRITE_UINT16_LE (record + 8 + 2 * i, channels[i]);
+  }
+  g_string_append_len (out, (const gchar *) record, sizeof (record));
+}
+
+static void
+append_random (GString * out, guint64 * rng)
+{
+  guint8 block[4096];
+  guint i;
+
+  for (i = 0; i < sizeof (block); i += 4)
+    GST_WRITE_UINT32_LE (block + i, rng_next (rng));
+  g_string_append_len (out, (const gchar *) block, sizeof (block));
+}
+
+/* The same 1 KiB over and over, with a byte changed now and then */
+static void
+append_redundant (GString * out, guint64 * rng)
+{
+  static guint8 block[1024];
+  static gboolean init = FALSE;
+  guint i;
+
+  if (!init) {
+    for (i = 0; i < sizeof (block); i++)
+      block[i] = rng_next (rng);
+    init = TRUE;
+  }
+  if (rng_next (rng) % 64 == 0)
+    block[rng_next (rng) % sizeof (block)] = rng_next (rng);
+  g_string_append_len (out, (const gchar *) block, sizeof (block));
+}
+
+static const Corpus corpora[] = {
+  {"text", append_text},
+  {"json", append_json},
+  {"binary", append_binary},
+  {"random", append_random},
+  {"redundant", append_redundant},
+};
+
+static GBytes *
+make_corpus (const Corpus * corpus, gsize size)
+{
+  GString *out = g_string_sized_new (size + 4096);
+  guint64 rng = 0x9e3779b97f4a7c15;
+
+  while (out->len < size)
+    corpus->append (out, &rng);
+  g_string_truncate (out, size);
+
+  return g_bytes_new_take (g_string_free (out, FALSE), size);
+}
+
+static GBytes *
+compress_gzip (const guint8 * data, gsize size)
+{
+  z_stream strm;
+  guint8 *out;
+  gsize len;
+
+  memset (&strm, 0, sizeof (strm));
+  if (deflateInit2 (&strm, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+  len = deflateBound (&strm, size);
+  out = g_malloc (len);
+  strm.next_in = (Bytef *) data;
+  strm.avail_in = size;
+  strm.next_out = out;
+  strm.avail_out = len;
+  if (deflate (&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd (&strm);
+    g_free (out);
+    return NULL;
+  }
+  len = strm.total_out;
+  deflateEnd (&strm);
+
+  return g_bytes_new_take (out, len);
+}
+
+static GBytes *
+compress_bzip2 (const guint8 * data, gsize size)
+{
+  unsigned int len = size + size / 100 + 600;
+  guint8 *out = g_malloc (len);
+
+  if (BZ2_bzBuffToBuffCompress ((char *) out, &len, (char *) data, size, 9,
+          0, 0) != BZ_OK) {
+    g_free (out);
+    return NULL;
+  }
+
+  return g_bytes_new_take (out, len);
+}
+
+#ifdef HAVE_ZSTD
+static GBytes *
+compress_zstd (const guint8 * data, gsize size)
+{
+  gsize len = ZSTD_compressBound (size);
+  guint8 *out = g_malloc (len);
+
+  len = ZSTD_compress (out, len, data, size, 3);
+  if (ZSTD_isError (len)) {
+    g_free (out);
+    return NULL;
+  }
+
+  return g_bytes_new_take (out, len);
+}
+#endif
+
+#ifdef HAVE_LZMA
+static GBytes *
+compress_xz (const guint8 * data, gsize size)
+{
+  gsize len = lzma_stream_buffer_bound (size);
+  guint8 *out = g_malloc (len);
+  size_t pos = 0;
+
+  if (lzma_easy_buffer_encode (6, LZMA_CHECK_CRC64, NULL, data, size, out,
+          &pos, len) != LZMA_OK) {
+    g_free (out);
+    return NULL;
+  }
+
+  return g_bytes_new_take (out, pos);
+}
+#endif
+
+#ifdef HAVE_LZ4
+static GBytes *
+compress_lz4 (const guint8 * data, gsize size)
+{
+  gsize len = LZ4F_compressFrameBound (size, NULL);
+  guint8 *out = g_malloc (len);
+
+  len = LZ4F_compressFrame (out, len, data, size, NULL);
+  if (LZ4F_isError (len)) {
+    g_free (out);
+    return NULL;
+  }
+
+  return g_bytes_new_take (out, len);
+}
+#endif
+
+static const Backend backends[] = {
+  {"gzip", compress_gzip, "engine=zlib"},
+  {"gzip-auto", compress_gzip, "engine=auto"},
+#ifdef HAVE_LIBDEFLATE
+  {"gzip-libdeflate", compress_gzip, "engine=libdeflate"},
+#endif
+  {"bzip2", compress_bzip2, ""},
+#ifdef HAVE_ZSTD
+  {"zstd", compress_zstd, ""},
+#endif
+#ifdef HAVE_LZMA
+  {"xz", compress_xz, ""},
+#endif
+#ifdef HAVE_LZ4
+  {"lz4", compress_lz4, ""},
+#endif
+};
+
+/* Peak RSS of the process, reset before every run when Linux allows it */
+static void
+reset_peak_rss (void)
+{
+  FILE *f = fopen ("/proc/self/clear_refs", "w");
+
+  if (f) {
+    fputs ("5", f);
+    fclose (f);
+  }
+}
+
+static guint64
+peak_rss_kib (void)
+{
+  struct rusage usage;
+  gchar line[256];
+  guint64 kib = 0;
+  FILE *f;
+
+  f = fopen ("/proc/self/status", "r");
+  if (f) {
+    while (fgets (line, sizeof (line), f))
+      if (sscanf (line, "VmHWM: %" G_GUINT64_FORMAT, &kib) == 1)
+        break;
+    fclose (f);
+  }
+  if (kib == 0 && getrusage (RUSAGE_SELF, &usage) == 0)
+    kib = usage.ru_maxrss;
+
+  return kib;
+}
+
+static gdouble
+timeval_seconds (const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Set "name=value" pairs separated by spaces on @element */
+static gboolean
+set_properties (GstElement * element, const gchar * props)
+{
+  gchar **pairs, **kv;
+  guint i;
+  gboolean ok = TRUE;
+
+  pairs = g_strsplit (props, " ", -1);
+  for (i = 0; ok && pairs[i]; i++) {
+    if (*pairs[i] == '\0')
+      continue;
+    kv = g_strsplit (pairs[i], "=", 2);
+    ok = kv[1] && g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+        kv[0]);
+    if (ok)
+      gst_util_set_object_arg (G_OBJECT (element), kv[0], kv[1]);
+    else
+      g_printerr ("Bad gzdec property: %s\n", pairs[i]);
+    g_strfreev (kv);
+  }
+  g_strfreev (pairs);
+
+  return ok;
+}
+
+/* Decode @compressed in @block sized buffers, printing a report line.
+ * Returns FALSE when the pipeline fails or the output doesn't match */
+static gboolean
+run (const gchar * corpus, const Backend * backend, const gchar * props,
+    GBytes * original, GBytes * compressed, gsize block)
+{
+  GstElement *pipeline, *src, *dec, *sink;
+  GstSample *sample;
+  GstBuffer *buf;
+  GstMapInfo map;
+  GstMessage *msg;
+  GstStructure *stats = NULL;
+  struct rusage before, after;
+  const guint8 *data;
+  gsize size, offset, out_size = 0;
+  guint64 buffers = 0, decode_time = 0;
+  guint32 crc = crc32 (0, NULL, 0);
+  gint64 start, end;
+  gdouble wall, user, sys;
+  gboolean ok;
+
+  pipeline = gst_parse_launch ("appsrc name=src format=bytes ! "
+      "gzdec name=dec ! appsink name=sink sync=false", NULL);
+  if (!pipeline)
+    return FALSE;
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  dec = gst_bin_get_by_name (GST_BIN (pipeline), "dec");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (src, "max-bytes", (guint64) 0, NULL);
+
+  ok = set_properties (dec, backend->props) && set_properties (dec, props);
+  if (!ok)
+    goto done;
+
+  // The whole input is queued first, so the source costs no I/O. appsrc
+  // takes buffers once started, the first ones are decoded to preroll
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  data = g_bytes_get_data (compressed, &size);
+  for (offset = 0; offset < size; offset += block) {
+    buf = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+        (gpointer) (data + offset), MIN (block, size - offset), 0,
+        MIN (block, size - offset), NULL, NULL);
+    gst_app_src_push_buffer (GST_APP_SRC (src), buf);
+    buffers++;
+  }
+  gst_app_src_end_of_stream (GST_APP_SRC (src));
+
+  reset_peak_rss ();
+  getrusage (RUSAGE_SELF, &before);
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    buf = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buf, &map, GST_MAP_READ)) {
+      crc = crc32 (crc, map.data, map.size);
+      out_size += map.size;
+      gst_buffer_unmap (buf, &map);
+    }
+    gst_sample_unref (sample);
+  }
+
+  end = g_get_monotonic_time ();
+  getrusage (RUSAGE_SELF, &after);
+
+  msg = gst_bus_pop_filtered (GST_ELEMENT_BUS (pipeline), GST_MESSAGE_ERROR);
+  if (msg) {
+    g_printerr ("%s/%s: pipeline error\n", corpus, backend->name);
+    gst_message_unref (msg);
+    ok = FALSE;
+  }
+
+  data = g_bytes_get_data (original, &size);
+  if (out_size != size || crc != crc32 (crc32 (0, NULL, 0), data, size)) {
+    g_printerr ("%s/%s: output differs from the corpus\n", corpus,
+        backend->name);
+    ok = FALSE;
+  }
+
+  g_object_get (dec, "stats", &stats, NULL);
+  if (stats) {
+    gst_structure_get_uint64 (stats, "decode-time", &decode_time);
+    gst_structure_free (stats);
+  }
+
+  wall = (end - start) / 1e6;
+  user = timeval_seconds (&after.ru_utime) -
+      timeval_seconds (&before.ru_utime);
+  sys = timeval_seconds (&after.ru_stime) -
+      timeval_seconds (&before.ru_stime);
+  g_print ("%-10s %-16s %8" G_GSIZE_FORMAT " %9.1f %10.0f %7.2f %7.3f "
+      "%6.3f %6.3f %8.1f%% %8" G_GUINT64_FORMAT "%s\n", corpus,
+      backend->name, block, out_size / wall / 1e6, buffers / wall,
+      (gdouble) out_size / g_bytes_get_size (compressed), wall, user, sys,
+      100.0 * decode_time / 1e9 / wall, peak_rss_kib (), ok ? "" : " FAIL");
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (dec);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return ok;
+}
+
+/* Whether @name is in the comma separated @list, or there's no list */
+static gboolean
+selected (const gchar * list, const gchar * name)
+{
+  gchar **names;
+  gboolean found;
+
+  if (!list)
+    return TRUE;
+  names = g_strsplit (list, ",", -1);
+  found = g_strv_contains ((const gchar * const *) names, name);
+  g_strfreev (names);
+
+  return found;
+}
+
+int
+main (int argc, char **argv)
+{
+  gint size = DEFAULT_SIZE;
+  gint repeat = DEFAULT_REPEAT;
+  gchar *blocks_arg = NULL;
+  gchar *corpora_arg = NULL;
+  gchar *backends_arg = NULL;
+  gchar *props = NULL;
+  GOptionEntry entries[] = {
+    {"size", 's', 0, G_OPTION_ARG_INT, &size,
+        "MiB of every corpus (default 16)", "MIB"},
+    {"blocks", 'b', 0, G_OPTION_ARG_STRING, &blocks_arg,
+        "Input buffer sizes (default " DEFAULT_BLOCKS ")", "SIZE,..."},
+    {"corpus", 'c', 0, G_OPTION_ARG_STRING, &corpora_arg,
+        "Corpora: text, json, binary, random, redundant (default all)",
+        "NAME,..."},
+    {"backend", 'f', 0, G_OPTION_ARG_STRING, &backends_arg,
+        "Backends: gzip, gzip-auto, gzip-libdeflate, bzip2, zstd, xz, lz4 "
+          "(default all those built)", "NAME,..."},
+    {"props", 'p', 0, G_OPTION_ARG_STRING, &props,
+        "gzdec properties for every run, e.g. \"decode-thread=true\"",
+        "\"NAME=VALUE ...\""},
+    {"repeat", 'r', 0, G_OPTION_ARG_INT, &repeat,
+        "Runs of every case (default 1)", "N"},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GBytes *original, *compressed;
+  gchar **blocks;
+  gsize block;
+  guint c, b, i;
+  gint r;
+  gboolean ok = TRUE;
+
+  ctx = g_option_context_new ("- gzdec throughput benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 2;
+  }
+  g_option_context_free (ctx);
+
+  if (!gst_registry_check_feature_version (gst_registry_get (), "gzdec",
+          1, 0, 0)) {
+    g_printerr ("gzdec not found, set GST_PLUGIN_PATH\n");
+    return 2;
+  }
+
+  blocks = g_strsplit (blocks_arg ? blocks_arg : DEFAULT_BLOCKS, ",", -1);
+  g_print ("%-10s %-16s %8s %9s %10s %7s %7s %6s %6s %9s %8s\n", "corpus",
+      "backend", "block", "MB/s", "buffers/s", "ratio", "wall", "user",
+      "sys", "inflate", "rss KiB");
+
+  for (c = 0; c < G_N_ELEMENTS (corpora); c++) {
+    if (!selected (corpora_arg, corpora[c].name))
+      continue;
+    original = make_corpus (&corpora[c], (gsize) size * 1024 * 1024);
+
+    for (b = 0; b < G_N_ELEMENTS (backends); b++) {
+      if (!selected (backends_arg, backends[b].name))
+        continue;
+      compressed = backends[b].compress (g_bytes_get_data (original, NULL),
+          g_bytes_get_size (original));
+      if (!compressed) {
+        g_printerr ("%s: %s compression failed\n", corpora[c].name,
+            backends[b].name);
+        ok = FALSE;
+        continue;
+      }
+
+      for (i = 0; blocks[i]; i++) {
+        block = g_ascii_strtoull (blocks[i], NULL, 10);
+        if (block == 0) {
+          g_printerr ("Bad block size: %s\n", blocks[i]);
+          ok = FALSE;
+          continue;
+        }
+        for (r = 0; r < repeat; r++)
+          ok &= run (corpora[c].name, &backends[b], props ? props : "",
+              original, compressed, block);
+      }
+      g_bytes_unref (compressed);
+    }
+    g_bytes_unref (original);
+  }
+  g_strfreev (blocks);
+
+  return ok ? 0 : 1;
+}
@@ -32,6 +32,13 @@
  * gst-launch-1.0 filesrc location=file.txt.bz ! 'application/x-bzip' ! gzdec ! filesink location=file.txt
  * ]|
  * This pipeline decompress the file file.txt.bz into file.txt using bzlib2
+ *
+ * |[
+ * gst-launch-1.0 filesrc location=video.mp4.gz ! gzdec ! qtdemux ! fakesink
+ * ]|
+ * When downstream pulls and upstream is seekable, gzip streams are decoded
+ * on demand. Checkpoints are recorded every index-interval bytes of output,
+ * so seeks only inflate from the nearest one
  * </refsect2>
  */
 
@@ -39,7 +46,10 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+#include <glib/gstdio.h>
 #include <gst/gst.h>
+#include <gst/base/gsttypefindhelper.h>
 #include "gstgzdec.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_gzdec_debug);
@@ -52,65 +62,317 @@ static void gst_gzdec_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_gzdec_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_gzdec_finalize (GObject * object);
 static void gst_gzdec_state_changed (GstElement * element, GstState oldstate,
     GstState newstate, GstState pending);
 
 static GstFlowReturn gst_gzdec_chain (GstPad * pad, GstObject * parent,
     GstBuffer * buffer);
-static GstFlowReturn gst_gzdec_event (GstPad * pad, GstObject * parent,
+static gboolean gst_gzdec_event (GstPad * pad, GstObject * parent,
+    GstEvent * event);
+static gboolean gst_gzdec_src_event (GstPad * pad, GstObject * parent,
     GstEvent * event);
+static gboolean gst_gzdec_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query);
+static gboolean gst_gzdec_handle_event (GstGzdec * gzdec, GstEvent * event);
+static gboolean gst_gzdec_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active);
+static GstFlowReturn gst_gzdec_get_range (GstPad * pad, GstObject * parent,
+    guint64 offset, guint length, GstBuffer ** buffer);
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_BUFFER_MODE,
+  PROP_MIN_BUFFER_SIZE,
+  PROP_MAX_BUFFER_SIZE,
+  PROP_TARGET_BUFFER_SIZE,
+  PROP_POOL_BUFFERS,
+  PROP_MULTI_MEMBER,
+  PROP_THREADS,
+  PROP_MAX_IN_FLIGHT,
+  PROP_INDEX_INTERVAL,
+  PROP_INDEX_FILE,
+  PROP_USE_INDEX_FILE,
+  PROP_ZERO_COPY_STORED,
+  PROP_FORMAT,
+  PROP_WINDOW_LOG_MAX,
+  PROP_DICTIONARY_LOCATION,
+  PROP_MEMORY_LIMIT,
+  PROP_ENGINE,
+  PROP_ACTIVE_ENGINE,
+  PROP_DECODE_THREAD,
+  PROP_MAX_SIZE_BUFFERS,
+  PROP_MAX_SIZE_BYTES,
+  PROP_MAX_SIZE_TIME,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_MAX_LATENCY,
+  PROP_ARENA_SIZE
 };
 
+#define DEFAULT_BUFFER_MODE         GST_GZDEC_BUFFER_MODE_ADAPTIVE
+#define DEFAULT_MIN_BUFFER_SIZE     4096
+#define DEFAULT_MAX_BUFFER_SIZE     (4 * 1024 * 1024)
+#define DEFAULT_TARGET_BUFFER_SIZE  (64 * 1024)
+#define DEFAULT_POOL_BUFFERS        4
+#define DEFAULT_MULTI_MEMBER        FALSE
+#define DEFAULT_THREADS             1
+#define DEFAULT_MAX_IN_FLIGHT       0
+#define DEFAULT_INDEX_INTERVAL      (4 * 1024 * 1024)
+#define DEFAULT_INDEX_FILE          NULL
+#define DEFAULT_USE_INDEX_FILE      FALSE
+#define DEFAULT_ZERO_COPY_STORED    FALSE
+#define DEFAULT_FORMAT              GST_GZDEC_FORMAT_AUTO
+#define DEFAULT_WINDOW_LOG_MAX      0
+#define DEFAULT_DICTIONARY_LOCATION NULL
+#define DEFAULT_MEMORY_LIMIT        0
+#define DEFAULT_ENGINE              GST_GZDEC_ENGINE_AUTO
+#define DEFAULT_DECODE_THREAD       FALSE
+#define DEFAULT_MAX_SIZE_BUFFERS    16
+#define DEFAULT_MAX_SIZE_BYTES      (4 * 1024 * 1024)
+#define DEFAULT_MAX_SIZE_TIME       0
+#define DEFAULT_STATS_INTERVAL      0
+#define DEFAULT_MAX_LATENCY         0
+#define DEFAULT_ARENA_SIZE          0
+
+/* Bytes needed to tell the formats apart */
+#define SNIFF_SIZE                  6
+
+/* Pull mode input chunks, and the size of the buffer used to drop the data
+ * before the requested offset */
+#define PULL_CHUNK_SIZE             (64 * 1024)
+#define PULL_SCRATCH_SIZE           (64 * 1024)
+
+/* Once this many input bytes have been observed the ratio counters are
+ * halved, so the estimation follows changes along the stream */
+#define RATIO_WINDOW                (16 * 1024 * 1024)
+
 /* pad templates */
 
 static GstStaticPadTemplate src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("application/unknown")
+    GST_STATIC_CAPS_ANY
     );
 
+#ifdef HAVE_ZSTD
+#define ZSTD_CAPS "; application/zstd"
+#else
+#define ZSTD_CAPS ""
+#endif
+#ifdef HAVE_LZMA
+#define XZ_CAPS "; application/x-xz"
+#else
+#define XZ_CAPS ""
+#endif
+#ifdef HAVE_LZ4
+#define LZ4_CAPS "; application/x-lz4"
+#else
+#define LZ4_CAPS ""
+#endif
+
 static GstStaticPadTemplate sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("application/x-gzip; application/x-bzip")
+    GST_STATIC_CAPS ("application/x-gzip; application/x-bzip; "
+        "application/x-zlib; application/x-deflate" ZSTD_CAPS XZ_CAPS
+        LZ4_CAPS)
     );
 
 #define gst_gzdec_parent_class parent_class
 G_DEFINE_TYPE (GstGzdec, gst_gzdec, GST_TYPE_ELEMENT);
 
+GType
+gst_gzdec_buffer_mode_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_GZDEC_BUFFER_MODE_ADAPTIVE,
+        "Follow the observed compression ratio", "adaptive"},
+    {GST_GZDEC_BUFFER_MODE_FIXED, "Always use the target size", "fixed"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstGzdecBufferMode", values);
+    g_once_init_leave (&type, tmp);
+  }
+
+  return type;
+}
+
+GType
+gst_gzdec_format_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_GZDEC_FORMAT_AUTO, "Detect from the stream", "auto"},
+    {GST_GZDEC_FORMAT_GZIP, "gzip", "gzip"},
+    {GST_GZDEC_FORMAT_ZLIB, "zlib stream", "zlib"},
+    {GST_GZDEC_FORMAT_DEFLATE, "Raw deflate", "deflate"},
+    {GST_GZDEC_FORMAT_BZIP2, "bzip2", "bzip2"},
+    {GST_GZDEC_FORMAT_ZSTD, "Zstandard", "zstd"},
+    {GST_GZDEC_FORMAT_XZ, "xz", "xz"},
+    {GST_GZDEC_FORMAT_LZ4, "LZ4 frames", "lz4"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstGzdecFormat", values);
+    g_once_init_leave (&type, tmp);
+  }
+
+  return type;
+}
+
+GType
+gst_gzdec_engine_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_GZDEC_ENGINE_AUTO, "Choose automatically", "auto"},
+    {GST_GZDEC_ENGINE_ZLIB, "Streaming zlib or zlib-ng", "zlib"},
+    {GST_GZDEC_ENGINE_LIBDEFLATE, "Whole input with libdeflate, up to "
+          "64 MiB", "libdeflate"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstGzdecEngine", values);
+    g_once_init_leave (&type, tmp);
+  }
+
+  return type;
+}
+
 
 /* (b)zlib auxiliary methods */
-#define XZ_ZLIB         0
-#define XZ_BZLIB        1
 #define XZ_ERROR        (1 << 0)
 #define XZ_MORE_OUTPUT  (1 << 1)
 #define XZ_CONTINUE     (1 << 2)
 #define XZ_FINISH       (1 << 3)
 #define XZ_MORE_INPUT   (1 << 4)
+#define XZ_END          (1 << 5)
+#define XZ_PASSTHROUGH  (1 << 6)
+
+/* Deflate window kept across the stored blocks passed through */
+#define ZC_WINDOW_SIZE  32768
+
+/* Deflate can't expand data more than this, which bounds the size taken from
+ * a (maybe bogus) gzip trailer */
+#define DEFLATE_MAX_RATIO 1032
+/* Input gathered for libdeflate before streaming it with zlib instead */
+#define LIBDEFLATE_MAX_INPUT (64 * 1024 * 1024)
+
+/* Header, empty deflate block and trailer */
+#define GZIP_MIN_MEMBER 20
 
-static void xzlib_init (GstGzdec * gzdec, int type);
+static gboolean xzlib_init (GstGzdec * gzdec, GstGzdecFormat format);
 
 static int zlib_init (GstGzdec * gzdec);
 static void zlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len);
 static void zlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len);
 static size_t zlib_out_buffer_size (GstGzdec * gzdec);
+static size_t zlib_in_buffer_left (GstGzdec * gzdec);
 static int zlib_uncompress_step (GstGzdec * gzdec);
+static int zlib_zc_uncompress_step (GstGzdec * gzdec);
+static int zlib_reset (GstGzdec * gzdec);
 static void zlib_free (GstGzdec * gzdec);
 
 static int bzlib_init (GstGzdec * gzdec);
 static void bzlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len);
 static void bzlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len);
 static size_t bzlib_out_buffer_size (GstGzdec * gzdec);
+static size_t bzlib_in_buffer_left (GstGzdec * gzdec);
 static int bzlib_uncompress_step (GstGzdec * gzdec);
+static int bzlib_reset (GstGzdec * gzdec);
 static void bzlib_free (GstGzdec * gzdec);
 
-static gboolean prepare_out_buffer (GstGzdec * gzdec, size_t in_buf_size);
+#ifdef HAVE_ZSTD
+static int zstd_init (GstGzdec * gzdec);
+static void zstd_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len);
+static void zstd_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len);
+static size_t zstd_out_buffer_size (GstGzdec * gzdec);
+static size_t zstd_in_buffer_left (GstGzdec * gzdec);
+static int zstd_uncompress_step (GstGzdec * gzdec);
+static int zstd_reset (GstGzdec * gzdec);
+static void zstd_free (GstGzdec * gzdec);
+#endif
+
+#ifdef HAVE_LZMA
+static int liblzma_init (GstGzdec * gzdec);
+static void liblzma_prepare_in_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static void liblzma_prepare_out_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static size_t liblzma_out_buffer_size (GstGzdec * gzdec);
+static size_t liblzma_in_buffer_left (GstGzdec * gzdec);
+static int liblzma_uncompress_step (GstGzdec * gzdec);
+static int liblzma_reset (GstGzdec * gzdec);
+static void liblzma_drain (GstGzdec * gzdec);
+static void liblzma_free (GstGzdec * gzdec);
+#endif
+
+#ifdef HAVE_LZ4
+static int lz4_init (GstGzdec * gzdec);
+static void lz4_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len);
+static void lz4_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len);
+static size_t lz4_out_buffer_size (GstGzdec * gzdec);
+static size_t lz4_in_buffer_left (GstGzdec * gzdec);
+static int lz4_uncompress_step (GstGzdec * gzdec);
+static int lz4_reset (GstGzdec * gzdec);
+static void lz4_drain (GstGzdec * gzdec);
+static void lz4_free (GstGzdec * gzdec);
+#endif
+
+#ifdef HAVE_LIBDEFLATE
+static int libdeflate_init (GstGzdec * gzdec);
+static void libdeflate_prepare_in_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static void libdeflate_prepare_out_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static size_t libdeflate_out_buffer_size (GstGzdec * gzdec);
+static int libdeflate_uncompress_step (GstGzdec * gzdec);
+static int libdeflate_reset (GstGzdec * gzdec);
+static void libdeflate_drain (GstGzdec * gzdec);
+static void libdeflate_free (GstGzdec * gzdec);
+#endif
+
+static int parallel_init (GstGzdec * gzdec, GstGzdecParallelFormat format);
+static void parallel_prepare_in_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static void parallel_prepare_out_buffer (GstGzdec * gzdec, void *buf,
+    size_t len);
+static size_t parallel_out_buffer_size (GstGzdec * gzdec);
+static int parallel_uncompress_step (GstGzdec * gzdec);
+static int parallel_reset (GstGzdec * gzdec);
+static void parallel_drain (GstGzdec * gzdec);
+static void parallel_free (GstGzdec * gzdec);
+
+static size_t out_buffer_size (GstGzdec * gzdec, size_t in_buf_size);
+static gboolean decide_allocation (GstGzdec * gzdec, size_t size);
+static void release_pool (GstGzdec * gzdec);
+static GstFlowReturn prepare_out_buffer (GstGzdec * gzdec, size_t in_buf_size);
+static void reset_timestamps (GstGzdec * gzdec);
 static GstFlowReturn push_out_buf (GstGzdec * gzdec);
+static GstFlowReturn flush_out_buf (GstGzdec * gzdec);
+static GstFlowReturn drain_decoder (GstGzdec * gzdec);
+static void flush_decoder (GstGzdec * gzdec);
+
+static GstFlowReturn decode_buffer (GstGzdec * gzdec, GstBuffer * in_buf);
+static GstStructure *stats_structure (GstGzdec * gzdec);
+static void stats_update (GstGzdec * gzdec, GstClockTime latency,
+    gboolean post);
+static void decode_loop (GstPad * pad);
+static gint64 get_duration (GstGzdec * gzdec);
+static GstGzdecIndex *push_index (GstGzdec * gzdec);
+static gboolean push_seek (GstGzdec * gzdec, GstEvent * event);
+static void seek_flushed (GstGzdec * gzdec, GstEvent * event);
+static gboolean input_is_gzip (GstGzdec * gzdec);
+static gboolean pull_start (GstGzdec * gzdec);
+static void pull_stop (GstGzdec * gzdec);
 
 static void
 gst_gzdec_class_init (GstGzdecClass * klass)
@@ -121,7 +383,7 @@ gst_gzdec_class_init (GstGzdecClass * klass)
   GST_DEBUG_CATEGORY_INIT (gst_gzdec_debug, "gzdec", 0, "gzdec element");
 
   gst_element_class_set_static_metadata (gstelement_class,
-      "gzip decoder", "Generic", "gzip/bzip decoder",
+      "gzip decoder", "Codec/Decoder", "gzip/zlib/deflate/bzip2 decoder",
       "Carlos Falgueras García <carlosfg@riseup.net");
 
   gst_element_class_add_static_pad_template (gstelement_class, &sink_template);
@@ -129,7 +391,156 @@ gst_gzdec_class_init (GstGzdecClass * klass)
 
   gobject_class->set_property = gst_gzdec_set_property;
   gobject_class->get_property = gst_gzdec_get_property;
+  gobject_class->finalize = gst_gzdec_finalize;
   gstelement_class->state_changed = gst_gzdec_state_changed;
+
+  g_object_class_install_property (gobject_class, PROP_BUFFER_MODE,
+      g_param_spec_enum ("buffer-mode", "Buffer mode",
+          "Policy used to size the output buffers",
+          GST_TYPE_GZDEC_BUFFER_MODE, DEFAULT_BUFFER_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MIN_BUFFER_SIZE,
+      g_param_spec_uint ("min-buffer-size", "Minimum buffer size",
+          "Minimum size of the output buffers in adaptive mode, raising "
+          "max-buffer-size when above it", 1, G_MAXINT, DEFAULT_MIN_BUFFER_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_BUFFER_SIZE,
+      g_param_spec_uint ("max-buffer-size", "Maximum buffer size",
+          "Maximum size of the output buffers in adaptive mode, lowering "
+          "min-buffer-size when below it", 1, G_MAXINT, DEFAULT_MAX_BUFFER_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TARGET_BUFFER_SIZE,
+      g_param_spec_uint ("target-buffer-size", "Target buffer size",
+          "Size of the output buffers in fixed mode, and initial guess "
+          "in adaptive mode", 1, G_MAXINT, DEFAULT_TARGET_BUFFER_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_POOL_BUFFERS,
+      g_param_spec_uint ("pool-buffers", "Pool buffers",
+          "Number of buffers preallocated by the internal pool, used when "
+          "downstream doesn't provide one", 0, G_MAXINT,
+          DEFAULT_POOL_BUFFERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MULTI_MEMBER,
+      g_param_spec_boolean ("multi-member", "Multi member",
+          "Keep decoding concatenated gzip members or bzip2 streams until "
+          "upstream EOS. Concatenated zstd frames are always decoded",
+          DEFAULT_MULTI_MEMBER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_uint ("threads", "Threads",
+          "Number of threads decoding bzip2 blocks, xz blocks, or gzip "
+          "members in multi-member mode, in parallel (0 = one per CPU, "
+          "1 = sequential decoding)", 0, G_MAXINT,
+          DEFAULT_THREADS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_IN_FLIGHT,
+      g_param_spec_uint ("max-in-flight", "Max in flight",
+          "Maximum number of blocks or members being decoded or waiting to "
+          "be pushed by the decoding threads (0 = twice the threads)",
+          0, G_MAXINT, DEFAULT_MAX_IN_FLIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_INDEX_INTERVAL,
+      g_param_spec_uint64 ("index-interval", "Index interval",
+          "Bytes of decoded data between the random access checkpoints "
+          "recorded in pull mode", 65536, G_MAXUINT64, DEFAULT_INDEX_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_INDEX_FILE,
+      g_param_spec_string ("index-file", "Index file",
+          "Location of the index file (NULL = the input location plus "
+          "\".gzidx\")", DEFAULT_INDEX_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_USE_INDEX_FILE,
+      g_param_spec_boolean ("use-index-file", "Use index file",
+          "Load the pull mode index from the index file, and write it there "
+          "once the whole input has been decoded", DEFAULT_USE_INDEX_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ZERO_COPY_STORED,
+      g_param_spec_boolean ("zero-copy-stored", "Zero copy stored",
+          "Push the stored (uncompressed) deflate blocks of gzip streams as "
+          "sub-buffers of the input instead of copying them",
+          DEFAULT_ZERO_COPY_STORED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FORMAT,
+      g_param_spec_enum ("format", "Format",
+          "Compressed format of the input, detected from its first bytes "
+          "in auto mode", GST_TYPE_GZDEC_FORMAT, DEFAULT_FORMAT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#ifdef HAVE_ZSTD
+  g_object_class_install_property (gobject_class, PROP_WINDOW_LOG_MAX,
+      g_param_spec_uint ("window-log-max", "Window log max",
+          "Largest zstd window accepted, as a power of two. Frames made "
+          "with long distance matching need more than the default "
+          "(0 = zstd default)", 0, 31, DEFAULT_WINDOW_LOG_MAX,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DICTIONARY_LOCATION,
+      g_param_spec_string ("dictionary-location", "Dictionary location",
+          "File holding the zstd dictionary the input was compressed with",
+          DEFAULT_DICTIONARY_LOCATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+#ifdef HAVE_LZMA
+  g_object_class_install_property (gobject_class, PROP_MEMORY_LIMIT,
+      g_param_spec_uint64 ("memory-limit", "Memory limit",
+          "Bytes of memory the xz decoder may use. Fewer threads are used "
+          "to stay below it, and decoding fails if one thread doesn't fit "
+          "(0 = unlimited)", 0, G_MAXUINT64, DEFAULT_MEMORY_LIMIT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+#endif
+  g_object_class_install_property (gobject_class, PROP_ENGINE,
+      g_param_spec_enum ("engine", "Engine",
+          "Library decoding gzip, zlib and raw deflate streams. libdeflate "
+          "is faster but decodes the whole input at once, on EOS, falling "
+          "back to zlib past 64 MiB of input",
+          GST_TYPE_GZDEC_ENGINE, DEFAULT_ENGINE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ACTIVE_ENGINE,
+      g_param_spec_string ("active-engine", "Active engine",
+          "Library and version decoding the current stream", NULL,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DECODE_THREAD,
+      g_param_spec_boolean ("decode-thread", "Decode thread",
+          "Decode in a thread of our own, fed by a bounded input queue, so "
+          "upstream keeps reading while decoding. Applies from the next "
+          "READY to PAUSED change", DEFAULT_DECODE_THREAD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BUFFERS,
+      g_param_spec_uint ("max-size-buffers", "Max size buffers",
+          "Input buffers queued for the decode thread (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_SIZE_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BYTES,
+      g_param_spec_uint ("max-size-bytes", "Max size bytes",
+          "Bytes of input queued for the decode thread (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_SIZE_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_TIME,
+      g_param_spec_uint64 ("max-size-time", "Max size time",
+          "Nanoseconds of timestamped input queued for the decode thread "
+          "(0 = unlimited)", 0, G_MAXUINT64, DEFAULT_MAX_SIZE_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Bytes and buffers in and out, compression ratio, decoding time "
+          "and longest time handling an input buffer, since the stream "
+          "start, and arena memory held by the decoder",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Statistics interval",
+          "Nanoseconds between the \"gzdec-stats\" element messages holding "
+          "the statistics, also posted at EOS (0 = no messages)",
+          0, G_MAXUINT64, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Max latency",
+          "Nanoseconds decoded data may wait for a full output buffer "
+          "before being pushed in a shorter one, which is also done when "
+          "the input runs dry (0 = unlimited)", 0, G_MAXUINT64,
+          DEFAULT_MAX_LATENCY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ARENA_SIZE,
+      g_param_spec_uint64 ("arena-size", "Arena size",
+          "Bytes reserved in the process wide arena, backed by huge pages "
+          "when available, the zlib and bzip2 states are allocated from "
+          "and recycled in. It grows past them when needed (0 = allocate "
+          "with malloc)", 0, G_MAXUINT64, DEFAULT_ARENA_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -147,10 +558,96 @@ gst_gzdec_init (GstGzdec * gzdec)
 
   /* srcpad */
   gzdec->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_event_function (gzdec->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_event));
+  gst_pad_set_query_function (gzdec->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_query));
+  gst_pad_set_activatemode_function (gzdec->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_src_activate_mode));
+  gst_pad_set_getrange_function (gzdec->srcpad,
+      GST_DEBUG_FUNCPTR (gst_gzdec_get_range));
   gst_element_add_pad (GST_ELEMENT (gzdec), gzdec->srcpad);
 
   gzdec->new_out_buf = TRUE;    // Force output buffer allocation at init
   gzdec->xz_initialized = FALSE;
+
+  gzdec->buffer_mode = DEFAULT_BUFFER_MODE;
+  gzdec->min_buffer_size = DEFAULT_MIN_BUFFER_SIZE;
+  gzdec->max_buffer_size = DEFAULT_MAX_BUFFER_SIZE;
+  gzdec->target_buffer_size = DEFAULT_TARGET_BUFFER_SIZE;
+  gzdec->ratio_in = 0;
+  gzdec->ratio_out = 0;
+
+  gzdec->pool = NULL;
+  gzdec->own_pool = FALSE;
+  gzdec->pool_buffer_size = 0;
+  gzdec->pool_buffers = DEFAULT_POOL_BUFFERS;
+
+  gzdec->format = DEFAULT_FORMAT;
+  gzdec->caps_format = GST_GZDEC_FORMAT_AUTO;
+  gzdec->sniff_buf = NULL;
+  gzdec->window_log_max = DEFAULT_WINDOW_LOG_MAX;
+  gzdec->dictionary_location = DEFAULT_DICTIONARY_LOCATION;
+  gzdec->memory_limit = DEFAULT_MEMORY_LIMIT;
+  gzdec->arena_size = DEFAULT_ARENA_SIZE;
+  memset (&gzdec->arena_usage, 0, sizeof (gzdec->arena_usage));
+  gzdec->engine = DEFAULT_ENGINE;
+  gzdec->active_engine = NULL;
+  gzdec->src_caps_set = FALSE;
+  gzdec->pending_segment = NULL;
+  gzdec->pending_events = NULL;
+
+  gzdec->multi_member = DEFAULT_MULTI_MEMBER;
+  gzdec->members = 0;
+  gzdec->member_out = 0;
+
+  gzdec->zero_copy_stored = DEFAULT_ZERO_COPY_STORED;
+  gzdec->zc_window = NULL;
+  gzdec->pt_buf = NULL;
+
+  gzdec->threads = DEFAULT_THREADS;
+  gzdec->max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+  gzdec->last_in_size = 0;
+
+  gzdec->decode_thread = DEFAULT_DECODE_THREAD;
+  gzdec->max_size_buffers = DEFAULT_MAX_SIZE_BUFFERS;
+  gzdec->max_size_bytes = DEFAULT_MAX_SIZE_BYTES;
+  gzdec->max_size_time = DEFAULT_MAX_SIZE_TIME;
+  gzdec->task_active = FALSE;
+  g_mutex_init (&gzdec->queue_lock);
+  g_cond_init (&gzdec->queue_cond);
+  g_queue_init (&gzdec->queue);
+  gzdec->queue_buffers = 0;
+  gzdec->queue_bytes = 0;
+  gzdec->queue_result = GST_FLOW_FLUSHING;
+
+  gzdec->pull_mode = FALSE;
+  gzdec->pull_buf = NULL;
+  gzdec->pull_scratch = NULL;
+  gzdec->index = NULL;
+  gzdec->index_interval = DEFAULT_INDEX_INTERVAL;
+  gzdec->index_file = DEFAULT_INDEX_FILE;
+  gzdec->use_index_file = DEFAULT_USE_INDEX_FILE;
+  gzdec->index_path = NULL;
+  gzdec->raw_restart = FALSE;
+  gzdec->index_tried = FALSE;
+  gzdec->seek_pending = FALSE;
+  gzdec->seek_restart = NULL;
+  gzdec->seek_discard = 0;
+
+  gzdec->total_out = 0;
+  gzdec->duration = 0;
+  reset_timestamps (gzdec);
+
+  memset (&gzdec->stats, 0, sizeof (gzdec->stats));
+  memset (&gzdec->stats_pending, 0, sizeof (gzdec->stats_pending));
+  gzdec->stats_interval = DEFAULT_STATS_INTERVAL;
+  gzdec->max_latency = DEFAULT_MAX_LATENCY;
+  gzdec->out_since = GST_CLOCK_TIME_NONE;
+  gzdec->last_in_time = GST_CLOCK_TIME_NONE;
+  gzdec->in_gap = GST_CLOCK_TIME_NONE;
+  gzdec->stats_last_post = GST_CLOCK_TIME_NONE;
+  gzdec->latency = NULL;
 }
 
 void
@@ -158,14 +655,120 @@ gst_gzdec_set_property (GObject * object, guint property_id,
     const GValue * value, GParamSpec * pspec)
 {
   GstGzdec *gzdec = GST_GZDEC (object);
+  guint clamped = 0;
 
   GST_DEBUG_OBJECT (gzdec, "set_property");
 
+  GST_OBJECT_LOCK (gzdec);
   switch (property_id) {
+    case PROP_BUFFER_MODE:
+      gzdec->buffer_mode = g_value_get_enum (value);
+      break;
+    case PROP_MIN_BUFFER_SIZE:
+      // The other bound follows, so they can be set in any order
+      gzdec->min_buffer_size = g_value_get_uint (value);
+      if (gzdec->max_buffer_size < gzdec->min_buffer_size) {
+        gzdec->max_buffer_size = gzdec->min_buffer_size;
+        clamped = gzdec->min_buffer_size;
+      }
+      break;
+    case PROP_MAX_BUFFER_SIZE:
+      gzdec->max_buffer_size = g_value_get_uint (value);
+      if (gzdec->min_buffer_size > gzdec->max_buffer_size) {
+        gzdec->min_buffer_size = gzdec->max_buffer_size;
+        clamped = gzdec->max_buffer_size;
+      }
+      break;
+    case PROP_TARGET_BUFFER_SIZE:
+      gzdec->target_buffer_size = g_value_get_uint (value);
+      break;
+    case PROP_POOL_BUFFERS:
+      gzdec->pool_buffers = g_value_get_uint (value);
+      break;
+    case PROP_MULTI_MEMBER:
+      gzdec->multi_member = g_value_get_boolean (value);
+      break;
+    case PROP_THREADS:
+      gzdec->threads = g_value_get_uint (value);
+      break;
+    case PROP_MAX_IN_FLIGHT:
+      gzdec->max_in_flight = g_value_get_uint (value);
+      break;
+    case PROP_INDEX_INTERVAL:
+      gzdec->index_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_INDEX_FILE:
+      g_free (gzdec->index_file);
+      gzdec->index_file = g_value_dup_string (value);
+      break;
+    case PROP_USE_INDEX_FILE:
+      gzdec->use_index_file = g_value_get_boolean (value);
+      break;
+    case PROP_ZERO_COPY_STORED:
+      gzdec->zero_copy_stored = g_value_get_boolean (value);
+      break;
+    case PROP_FORMAT:
+      gzdec->format = g_value_get_enum (value);
+      break;
+    case PROP_WINDOW_LOG_MAX:
+      gzdec->window_log_max = g_value_get_uint (value);
+      break;
+    case PROP_DICTIONARY_LOCATION:
+      g_free (gzdec->dictionary_location);
+      gzdec->dictionary_location = g_value_dup_string (value);
+      break;
+    case PROP_MEMORY_LIMIT:
+      gzdec->memory_limit = g_value_get_uint64 (value);
+      break;
+    case PROP_ENGINE:
+      gzdec->engine = g_value_get_enum (value);
+      break;
+    case PROP_DECODE_THREAD:
+      gzdec->decode_thread = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_SIZE_BUFFERS:
+      gzdec->max_size_buffers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      gzdec->max_size_bytes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      gzdec->max_size_time = g_value_get_uint64 (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      gzdec->stats_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_MAX_LATENCY:
+      gzdec->max_latency = g_value_get_uint64 (value);
+      break;
+    case PROP_ARENA_SIZE:
+      gzdec->arena_size = g_value_get_uint64 (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
   }
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (clamped > 0)
+    GST_WARNING_OBJECT (gzdec, "min-buffer-size can't be above "
+        "max-buffer-size, both set to %u", clamped);
+
+  // A larger queue may let a waiting chain go on
+  switch (property_id) {
+    case PROP_MAX_SIZE_BUFFERS:
+    case PROP_MAX_SIZE_BYTES:
+    case PROP_MAX_SIZE_TIME:
+      g_mutex_lock (&gzdec->queue_lock);
+      g_cond_broadcast (&gzdec->queue_cond);
+      g_mutex_unlock (&gzdec->queue_lock);
+      break;
+    case PROP_MAX_LATENCY:
+      // The pipeline latency has to be computed again
+      gst_element_post_message (GST_ELEMENT_CAST (gzdec),
+          gst_message_new_latency (GST_OBJECT_CAST (gzdec)));
+      break;
+  }
 }
 
 void
@@ -176,11 +779,106 @@ gst_gzdec_get_property (GObject * object, guint property_id,
 
   GST_DEBUG_OBJECT (gzdec, "get_property");
 
+  GST_OBJECT_LOCK (gzdec);
   switch (property_id) {
+    case PROP_BUFFER_MODE:
+      g_value_set_enum (value, gzdec->buffer_mode);
+      break;
+    case PROP_MIN_BUFFER_SIZE:
+      g_value_set_uint (value, gzdec->min_buffer_size);
+      break;
+    case PROP_MAX_BUFFER_SIZE:
+      g_value_set_uint (value, gzdec->max_buffer_size);
+      break;
+    case PROP_TARGET_BUFFER_SIZE:
+      g_value_set_uint (value, gzdec->target_buffer_size);
+      break;
+    case PROP_POOL_BUFFERS:
+      g_value_set_uint (value, gzdec->pool_buffers);
+      break;
+    case PROP_MULTI_MEMBER:
+      g_value_set_boolean (value, gzdec->multi_member);
+      break;
+    case PROP_THREADS:
+      g_value_set_uint (value, gzdec->threads);
+      break;
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, gzdec->max_in_flight);
+      break;
+    case PROP_INDEX_INTERVAL:
+      g_value_set_uint64 (value, gzdec->index_interval);
+      break;
+    case PROP_INDEX_FILE:
+      g_value_set_string (value, gzdec->index_file);
+      break;
+    case PROP_USE_INDEX_FILE:
+      g_value_set_boolean (value, gzdec->use_index_file);
+      break;
+    case PROP_ZERO_COPY_STORED:
+      g_value_set_boolean (value, gzdec->zero_copy_stored);
+      break;
+    case PROP_FORMAT:
+      g_value_set_enum (value, gzdec->format);
+      break;
+    case PROP_WINDOW_LOG_MAX:
+      g_value_set_uint (value, gzdec->window_log_max);
+      break;
+    case PROP_DICTIONARY_LOCATION:
+      g_value_set_string (value, gzdec->dictionary_location);
+      break;
+    case PROP_MEMORY_LIMIT:
+      g_value_set_uint64 (value, gzdec->memory_limit);
+      break;
+    case PROP_ENGINE:
+      g_value_set_enum (value, gzdec->engine);
+      break;
+    case PROP_ACTIVE_ENGINE:
+      g_value_set_string (value, gzdec->active_engine);
+      break;
+    case PROP_DECODE_THREAD:
+      g_value_set_boolean (value, gzdec->decode_thread);
+      break;
+    case PROP_MAX_SIZE_BUFFERS:
+      g_value_set_uint (value, gzdec->max_size_buffers);
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      g_value_set_uint (value, gzdec->max_size_bytes);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      g_value_set_uint64 (value, gzdec->max_size_time);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, stats_structure (gzdec));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint64 (value, gzdec->stats_interval);
+      break;
+    case PROP_MAX_LATENCY:
+      g_value_set_uint64 (value, gzdec->max_latency);
+      break;
+    case PROP_ARENA_SIZE:
+      g_value_set_uint64 (value, gzdec->arena_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
   }
+  GST_OBJECT_UNLOCK (gzdec);
+}
+
+static void
+gst_gzdec_finalize (GObject * object)
+{
+  GstGzdec *gzdec = GST_GZDEC (object);
+
+  g_free (gzdec->index_file);
+  g_free (gzdec->dictionary_location);
+  g_free (gzdec->active_engine);
+  g_free (gzdec->latency);
+  g_mutex_clear (&gzdec->queue_lock);
+  g_cond_clear (&gzdec->queue_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static void
@@ -188,307 +886,3462 @@ gst_gzdec_state_changed (GstElement * element, GstState oldstate,
     GstState newstate, GstState pending)
 {
   GstGzdec *gzdec = GST_GZDEC (element);
+  GstGzdecIndex *index;
+  guint64 arena_size;
 
-  if ((newstate == GST_STATE_NULL) && (gzdec->xz_initialized)) {
-    gzdec->xz_free (gzdec);
+  // The statistics cover a run from READY
+  if (oldstate == GST_STATE_READY && newstate == GST_STATE_PAUSED) {
+    GST_OBJECT_LOCK (gzdec);
+    memset (&gzdec->stats, 0, sizeof (gzdec->stats));
+    memset (&gzdec->stats_pending, 0, sizeof (gzdec->stats_pending));
+    gzdec->stats_last_post = GST_CLOCK_TIME_NONE;
+    GST_OBJECT_UNLOCK (gzdec);
+
+    if (!gzdec->latency && gst_gzdec_latency_enabled ())
+      gzdec->latency = g_new0 (GstGzdecLatency, 1);
+
+    GST_OBJECT_LOCK (gzdec);
+    arena_size = gzdec->arena_size;
+    GST_OBJECT_UNLOCK (gzdec);
+    gst_gzdec_arena_reset_peak (&gzdec->arena_usage);
+    if (arena_size > 0)
+      gst_gzdec_arena_reserve (arena_size);
+  }
+
+  if (newstate == GST_STATE_NULL) {
+    GST_OBJECT_LOCK (gzdec);
+    g_clear_pointer (&gzdec->active_engine, g_free);
+    GST_OBJECT_UNLOCK (gzdec);
+  }
+  if (newstate <= GST_STATE_READY) {
+    // The next stream may have another format. The inflate state goes back
+    // to the process wide pool, the next stream takes it from there
+    if (gzdec->xz_initialized) {
+      gzdec->xz_free (gzdec);
+      gzdec->xz_initialized = FALSE;
+    }
+    flush_decoder (gzdec);
+
+    // The index loaded to seek in push mode, the pull one is gone already
+    GST_OBJECT_LOCK (gzdec);
+    index = gzdec->index;
+    gzdec->index = NULL;
+    gzdec->raw_restart = FALSE;
+    gzdec->index_tried = FALSE;
+    gzdec->seek_pending = FALSE;
+    GST_OBJECT_UNLOCK (gzdec);
+    if (index)
+      gst_gzdec_index_free (index);
+    g_clear_pointer (&gzdec->index_path, g_free);
+
+    if (gzdec->latency)
+      gst_gzdec_latency_report (GST_OBJECT_CAST (gzdec), gzdec->latency);
+    release_pool (gzdec);
+    gst_event_replace (&gzdec->pending_segment, NULL);
+    g_list_free_full (gzdec->pending_events,
+        (GDestroyNotify) gst_event_unref);
+    gzdec->pending_events = NULL;
+    gzdec->caps_format = GST_GZDEC_FORMAT_AUTO;
+    gzdec->src_caps_set = FALSE;
   }
 }
 
-static gboolean
-plugin_init (GstPlugin * plugin)
+/* Statistics as an element message or property value, with the object lock
+ * held */
+static GstStructure *
+stats_structure (GstGzdec * gzdec)
 {
-  return gst_element_register (plugin, "gzdec", GST_RANK_NONE, GST_TYPE_GZDEC);
+  GstGzdecStats *stats = &gzdec->stats;
+  gsize memory, peak_memory;
+
+  gst_gzdec_arena_usage (&gzdec->arena_usage, &memory, &peak_memory);
+
+  return gst_structure_new ("gzdec-stats",
+      "bytes-in", G_TYPE_UINT64, stats->bytes_in,
+      "bytes-out", G_TYPE_UINT64, stats->bytes_out,
+      "buffers-in", G_TYPE_UINT64, stats->buffers_in,
+      "buffers-out", G_TYPE_UINT64, stats->buffers_out,
+      "ratio", G_TYPE_DOUBLE, stats->bytes_in > 0 ?
+      (gdouble) stats->bytes_out / stats->bytes_in : 0.0,
+      "decode-time", G_TYPE_UINT64, stats->decode_time,
+      "max-latency", G_TYPE_UINT64, stats->max_latency,
+      "memory", G_TYPE_UINT64, (guint64) memory,
+      "peak-memory", G_TYPE_UINT64, (guint64) peak_memory, NULL);
 }
 
-static gboolean
-prepare_out_buffer (GstGzdec * gzdec, size_t in_buf_size)
+/* Add the counters of the streaming thread to the statistics, once per
+ * input buffer taking @latency, and post them when the interval is over
+ * or when @post */
+static void
+stats_update (GstGzdec * gzdec, GstClockTime latency, gboolean post)
 {
-  if (!gzdec->new_out_buf)
-    return TRUE;
+  GstGzdecStats *pending = &gzdec->stats_pending;
+  GstGzdecStats *stats = &gzdec->stats;
+  GstStructure *s = NULL;
+  GstClockTime now;
 
-  GST_DEBUG_OBJECT (gzdec, "Allocate new output buffer");
-  gzdec->out_buf_capacity = in_buf_size;
-  gzdec->out_buf =
-      gst_buffer_new_allocate (NULL, gzdec->out_buf_capacity, NULL);
+  GST_OBJECT_LOCK (gzdec);
+  stats->bytes_in += pending->bytes_in;
+  stats->bytes_out += pending->bytes_out;
+  stats->buffers_in += pending->buffers_in;
+  stats->buffers_out += pending->buffers_out;
+  stats->decode_time += pending->decode_time;
+  stats->max_latency = MAX (stats->max_latency, latency);
+  memset (pending, 0, sizeof (*pending));
 
-  if (!gzdec->out_buf)
-    return FALSE;
-  if (!gst_buffer_map (gzdec->out_buf, &gzdec->out_buf_map, GST_MAP_WRITE)) {
-    gst_buffer_unref (gzdec->out_buf);
-    return FALSE;
+  if (gzdec->stats_interval > 0) {
+    now = gst_util_get_timestamp ();
+    if (!GST_CLOCK_TIME_IS_VALID (gzdec->stats_last_post))
+      gzdec->stats_last_post = now;
+    if (post || now - gzdec->stats_last_post >= gzdec->stats_interval) {
+      s = stats_structure (gzdec);
+      gzdec->stats_last_post = now;
+    }
   }
+  GST_OBJECT_UNLOCK (gzdec);
 
-  gzdec->new_out_buf = FALSE;
-
-  gzdec->xz_prepare_out_buffer (gzdec,
-      gzdec->out_buf_map.data, gzdec->out_buf_map.size);
-
-  return TRUE;
+  if (s)
+    gst_element_post_message (GST_ELEMENT_CAST (gzdec),
+        gst_message_new_element (GST_OBJECT_CAST (gzdec), s));
 }
 
-static GstFlowReturn
-push_out_buf (GstGzdec * gzdec)
+/* Start of a step timed for the gzdec-latency tracer */
+#define TRACE_START(gzdec) ((gzdec)->latency ? gst_util_get_timestamp () : 0)
+
+static void
+trace_phase (GstGzdec * gzdec, GstGzdecPhase phase, GstClockTime start)
 {
-  gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
-  gst_buffer_set_size (gzdec->out_buf, gzdec->xz_out_buffer_size (gzdec));
-  gzdec->new_out_buf = TRUE;
-  return gst_pad_push (gzdec->srcpad, gzdec->out_buf);
+  if (gzdec->latency)
+    gst_gzdec_latency_add (gzdec->latency, phase,
+        gst_util_get_timestamp () - start);
 }
 
-static GstFlowReturn
-gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * in_buf)
+/* Run the backend, timing it */
+static int
+uncompress_step (GstGzdec * gzdec)
 {
-  GstGzdec *gzdec = GST_GZDEC (parent);
-  GstMapInfo in_buf_map;
-  GstFlowReturn ret = GST_FLOW_ERROR;
-  GstEvent *eos;
+  GstClockTime start, elapsed;
   int xz_ret;
 
-  GST_DEBUG_OBJECT (gzdec, "New input buffer");
-  if (!gst_buffer_map (in_buf, &in_buf_map, GST_MAP_READ))
-    goto free_in;
-
-  gzdec->xz_prepare_in_buffer (gzdec, in_buf_map.data, in_buf_map.size);
+  start = gst_util_get_timestamp ();
+  xz_ret = gzdec->xz_uncompress_step (gzdec);
+  elapsed = gst_util_get_timestamp () - start;
 
-  // Keep decompressing and pushing buffers until finish, error or input exhaust
-  do {
-    // Allocate new output buffer if necessary
-    if (!prepare_out_buffer (gzdec, in_buf_map.size))
-      goto unmap_in;
+  gzdec->stats_pending.decode_time += elapsed;
+  if (gzdec->latency)
+    gst_gzdec_latency_add (gzdec->latency, GST_GZDEC_PHASE_INFLATE, elapsed);
 
-    // Uncompress until error, input exhaust, output full or finish
-    GST_DEBUG_OBJECT (gzdec, "Uncompress step");
-    xz_ret = gzdec->xz_uncompress_step (gzdec);
+  return xz_ret;
+}
 
-    if (xz_ret & XZ_ERROR)
-      goto free_out;
+/* Choose the size of the next output buffer. In adaptive mode the input size
+ * is scaled by the running inflate ratio (plus some headroom), so a whole
+ * input buffer is usually inflated into a single output buffer */
+static size_t
+out_buffer_size (GstGzdec * gzdec, size_t in_buf_size)
+{
+  guint64 size;
+  guint min_size, max_size, target_size;
 
-    // Output buffer is full, push it and continue
-    if (xz_ret & XZ_MORE_OUTPUT) {
-      GST_DEBUG_OBJECT (gzdec, "Out buffer ready. Push it");
-      ret = push_out_buf (gzdec);
-      if (ret < 0)
-        goto unmap_in;
-    }
+  GST_OBJECT_LOCK (gzdec);
+  min_size = gzdec->min_buffer_size;
+  max_size = gzdec->max_buffer_size;
+  target_size = gzdec->target_buffer_size;
+  if (gzdec->buffer_mode == GST_GZDEC_BUFFER_MODE_FIXED) {
+    GST_OBJECT_UNLOCK (gzdec);
+    return target_size;
+  }
+  GST_OBJECT_UNLOCK (gzdec);
 
-    if (xz_ret & XZ_FINISH) {
-      GST_DEBUG_OBJECT (gzdec, "Decompression finish. Send EOS");
-      eos = gst_event_new_eos ();
-      gst_pad_push_event (gzdec->srcpad, eos);
-      ret = GST_FLOW_EOS;
-      goto unmap_in;
-    }
-  } while (!(xz_ret & XZ_MORE_INPUT));
+  if (gzdec->ratio_in == 0 || gzdec->ratio_out == 0)
+    return target_size;
 
-  ret = GST_FLOW_OK;
-  goto unmap_in;
+  size = gst_util_uint64_scale (in_buf_size, gzdec->ratio_out,
+      gzdec->ratio_in);
+  size += size / 8;
+  size = GST_ROUND_UP_N (size, 4096);
 
-free_out:
-  gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
-  gst_buffer_unref (gzdec->out_buf);
-unmap_in:
-  gst_buffer_unmap (in_buf, &in_buf_map);
-free_in:
-  gst_buffer_unref (in_buf);
-  return ret;
+  return CLAMP (size, min_size, max_size);
 }
 
-static GstFlowReturn
-gst_gzdec_event (GstPad * pad, GstObject * parent, GstEvent * event)
+static void
+release_pool (GstGzdec * gzdec)
 {
-  GstGzdec *gzdec = GST_GZDEC (parent);
-  const gchar *mtype;
-  GstStructure *structure;
-  GstCaps *caps;
-  int lib;
+  GstBufferPool *pool;
 
-  switch (GST_EVENT_TYPE (event)) {
-    case GST_EVENT_CAPS:
-      if (gzdec->xz_initialized) {
-        GST_DEBUG_OBJECT (gzdec, "Dynamic caps change not supported");
-        goto beach;
-      }
+  if (!gzdec->pool)
+    return;
 
-      gst_event_parse_caps (event, &caps);
-      GST_DEBUG_OBJECT (gzdec, "setcaps %" GST_PTR_FORMAT, caps);
-      structure = gst_caps_get_structure (caps, 0);
-      mtype = gst_structure_get_name (structure);
-
-      if (g_str_equal (mtype, "application/x-gzip")) {
-        GST_DEBUG_OBJECT (gzdec, "GZIP stream");
-        lib = XZ_ZLIB;
-      } else if (g_str_equal (mtype, "application/x-bzip")) {
-        GST_DEBUG_OBJECT (gzdec, "BZIP stream");
-        lib = XZ_BZLIB;
-      } else {
-        GST_DEBUG_OBJECT (gzdec, "Invalid caps");
-        goto beach;
-      }
-      xzlib_init (gzdec, lib);
-      break;
-  };
+  GST_OBJECT_LOCK (gzdec);
+  pool = gzdec->pool;
+  gzdec->pool = NULL;
+  GST_OBJECT_UNLOCK (gzdec);
+  gzdec->pool_buffer_size = 0;
 
-  return gst_pad_event_default (pad, parent, event);
-beach:
-  gst_event_unref (event);
-  return FALSE;
+  gst_buffer_pool_set_active (pool, FALSE);
+  gst_object_unref (pool);
 }
 
+/* Unblock the streaming thread waiting for a free output buffer, or let it
+ * acquire buffers again once the flush is over */
 static void
-xzlib_init (GstGzdec * gzdec, int type)
+set_pool_flushing (GstGzdec * gzdec, gboolean flushing)
 {
-  if (type == XZ_BZLIB) {
-    gzdec->xz_prepare_in_buffer  = bzlib_prepare_in_buffer;
-    gzdec->xz_prepare_out_buffer = bzlib_prepare_out_buffer;
-    gzdec->xz_uncompress_step    = bzlib_uncompress_step;
-    gzdec->xz_out_buffer_size    = bzlib_out_buffer_size;
-    gzdec->xz_free               = bzlib_free;
+  GstBufferPool *pool;
 
-    bzlib_init (gzdec);
-  } else {
-    gzdec->xz_prepare_in_buffer  = zlib_prepare_in_buffer;
-    gzdec->xz_prepare_out_buffer = zlib_prepare_out_buffer;
-    gzdec->xz_uncompress_step    = zlib_uncompress_step;
-    gzdec->xz_out_buffer_size    = zlib_out_buffer_size;
-    gzdec->xz_free               = zlib_free;
+  GST_OBJECT_LOCK (gzdec);
+  pool = gzdec->pool ? gst_object_ref (gzdec->pool) : NULL;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (!pool)
+    return;
 
-    zlib_init (gzdec);
-  }
-  gzdec->xz_initialized = TRUE;
+  gst_buffer_pool_set_flushing (pool, flushing);
+  gst_object_unref (pool);
 }
 
-static int
-zlib_init (GstGzdec * gzdec)
+/* Run an ALLOCATION query downstream and activate the pool it offers, or
+ * our own one (using the proposed allocator, if any) when there is none */
+static gboolean
+decide_allocation (GstGzdec * gzdec, size_t size)
 {
-  GST_DEBUG_OBJECT (gzdec, "zlib init");
-  gzdec->zstrm.next_in   = Z_NULL;
-  gzdec->zstrm.avail_in  = 0;
-  gzdec->zstrm.next_out  = Z_NULL;
-  gzdec->zstrm.avail_out = 0;
-  gzdec->zstrm.zalloc    = NULL;
-  gzdec->zstrm.zfree     = NULL;
+  GstCaps *caps;
+  GstQuery *query;
+  GstBufferPool *pool = NULL;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  guint pool_size = 0;
+  guint min = 0;
+  guint max = 0;
+
+  release_pool (gzdec);
+
+  caps = gst_pad_get_current_caps (gzdec->srcpad);
+  query = gst_query_new_allocation (caps, TRUE);
+  if (!gst_pad_peer_query (gzdec->srcpad, query))
+    GST_DEBUG_OBJECT (gzdec, "Allocation query failed");
+
+  gst_allocation_params_init (&params);
+  if (gst_query_get_n_allocation_params (query) > 0)
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &pool_size, &min,
+        &max);
+  gst_query_unref (query);
+
+  if (pool) {
+    GST_DEBUG_OBJECT (gzdec, "Using downstream pool %" GST_PTR_FORMAT, pool);
+    size = MAX (size, pool_size);
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    gst_buffer_pool_config_set_allocator (config, allocator, &params);
+    if (!gst_buffer_pool_set_config (pool, config)) {
+      GST_DEBUG_OBJECT (gzdec, "Downstream pool refused our config");
+      gst_object_unref (pool);
+      pool = NULL;
+    }
+  }
+
+  gzdec->own_pool = (pool == NULL);
+  if (!pool) {
+    GST_DEBUG_OBJECT (gzdec, "Using own pool");
+    pool = gst_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (pool);
+    GST_OBJECT_LOCK (gzdec);
+    gst_buffer_pool_config_set_params (config, caps, size,
+        gzdec->pool_buffers, 0);
+    GST_OBJECT_UNLOCK (gzdec);
+    gst_buffer_pool_config_set_allocator (config, allocator, &params);
+    if (!gst_buffer_pool_set_config (pool, config))
+      goto config_failed;
+  }
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, &pool_size, NULL, NULL);
+  gst_structure_free (config);
 
-  return inflateInit2 (&gzdec->zstrm, MAX_WBITS + 16);
+  if (!gst_buffer_pool_set_active (pool, TRUE))
+    goto activate_failed;
+
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->pool = pool;
+  GST_OBJECT_UNLOCK (gzdec);
+  gzdec->pool_buffer_size = pool_size;
+
+  if (allocator)
+    gst_object_unref (allocator);
+  if (caps)
+    gst_caps_unref (caps);
+  return TRUE;
+
+config_failed:
+  GST_ERROR_OBJECT (gzdec, "Failed to configure buffer pool");
+  goto error;
+activate_failed:
+  GST_ERROR_OBJECT (gzdec, "Failed to activate buffer pool");
+error:
+  gst_object_unref (pool);
+  if (allocator)
+    gst_object_unref (allocator);
+  if (caps)
+    gst_caps_unref (caps);
+  return FALSE;
 }
 
+/* Forget the input timestamps, the next buffer pushed starts anew */
 static void
-zlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+reset_timestamps (GstGzdec * gzdec)
 {
-  gzdec->zstrm.next_in  = buf;
-  gzdec->zstrm.avail_in = len;
+  gzdec->in_pts = GST_CLOCK_TIME_NONE;
+  gzdec->in_duration = GST_CLOCK_TIME_NONE;
+  gzdec->in_pos = 0;
+  gzdec->in_len = 0;
+  gzdec->prev_in_pts = GST_CLOCK_TIME_NONE;
+  gzdec->prev_in_pos = 0;
+  gzdec->out_pts = GST_CLOCK_TIME_NONE;
+  gzdec->pt_pts = GST_CLOCK_TIME_NONE;
+  gzdec->discont = TRUE;
 }
 
+/* Take the timestamps of a new input buffer. Without a duration, it is
+ * estimated from the time and the size of the input since the previous
+ * timestamped buffer */
 static void
-zlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+input_timestamps (GstGzdec * gzdec, GstBuffer * in_buf, gsize size)
 {
-  gzdec->zstrm.next_out  = buf;
-  gzdec->zstrm.avail_out = len;
+  GstClockTime pts;
+
+  if (GST_BUFFER_IS_DISCONT (in_buf)) {
+    gzdec->discont = TRUE;
+    gzdec->prev_in_pts = GST_CLOCK_TIME_NONE;
+  }
+
+  pts = GST_BUFFER_PTS_IS_VALID (in_buf) ? GST_BUFFER_PTS (in_buf) :
+      GST_BUFFER_DTS (in_buf);
+  gzdec->in_pos += gzdec->in_len;
+  gzdec->in_len = size;
+  gzdec->in_pts = pts;
+  gzdec->in_duration = GST_BUFFER_DURATION (in_buf);
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return;
+
+  if (!GST_CLOCK_TIME_IS_VALID (gzdec->in_duration)
+      && GST_CLOCK_TIME_IS_VALID (gzdec->prev_in_pts)
+      && pts > gzdec->prev_in_pts && gzdec->in_pos > gzdec->prev_in_pos)
+    gzdec->in_duration = gst_util_uint64_scale (size,
+        pts - gzdec->prev_in_pts, gzdec->in_pos - gzdec->prev_in_pos);
+  gzdec->prev_in_pts = pts;
+  gzdec->prev_in_pos = gzdec->in_pos;
 }
 
-static size_t
-zlib_out_buffer_size (GstGzdec * gzdec)
+/* Time of the compressed byte @offset bytes into the input buffer, in
+ * proportion to its duration */
+static GstClockTime
+input_time (GstGzdec * gzdec, gsize offset)
 {
-  return gzdec->out_buf_capacity - gzdec->zstrm.avail_out;
+  if (!GST_CLOCK_TIME_IS_VALID (gzdec->in_pts)
+      || !GST_CLOCK_TIME_IS_VALID (gzdec->in_duration) || gzdec->in_len == 0)
+    return gzdec->in_pts;
+
+  return gzdec->in_pts + gst_util_uint64_scale (MIN (offset, gzdec->in_len),
+      gzdec->in_duration, gzdec->in_len);
 }
 
-static int
-zlib_uncompress_step (GstGzdec * gzdec)
+/* Time of the next compressed byte the backend will read */
+static GstClockTime
+decoder_time (GstGzdec * gzdec)
 {
+  gsize left = 0;
+
+  if (gzdec->xz_in_buffer_left)
+    left = MIN (gzdec->xz_in_buffer_left (gzdec), gzdec->in_len);
+  return input_time (gzdec, gzdec->in_len - left);
+}
+
+/* Set the offsets of @buf in the decoded stream and its time, flagging the
+ * first buffer after a gap. Decoded bytes aren't reordered, so the DTS is
+ * the PTS */
+static void
+stamp_buffer (GstGzdec * gzdec, GstBuffer * buf, GstClockTime pts)
+{
+  gsize size = gst_buffer_get_size (buf);
+
+  GST_BUFFER_OFFSET (buf) = gzdec->total_out;
+  GST_BUFFER_OFFSET_END (buf) = gzdec->total_out + size;
+  GST_BUFFER_PTS (buf) = pts;
+  GST_BUFFER_DTS (buf) = pts;
+  GST_BUFFER_DURATION (buf) = GST_CLOCK_TIME_NONE;
+  if (gzdec->discont) {
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    gzdec->discont = FALSE;
+  } else {
+    GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_DISCONT);
+  }
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->total_out += size;
+  GST_OBJECT_UNLOCK (gzdec);
+}
+
+static GstFlowReturn
+prepare_out_buffer (GstGzdec * gzdec, size_t in_buf_size)
+{
+  GstClockTime start;
+  GstFlowReturn ret;
+  size_t size;
+
+  if (!gzdec->new_out_buf)
+    return GST_FLOW_OK;
+
+  start = TRACE_START (gzdec);
+
+  // Negotiate a new pool on reconfiguration, or when our own pool doesn't
+  // fit the wanted size anymore
+  size = out_buffer_size (gzdec, in_buf_size);
+  if (gst_pad_check_reconfigure (gzdec->srcpad) || !gzdec->pool
+      || (gzdec->own_pool && (size > gzdec->pool_buffer_size
+              || size < gzdec->pool_buffer_size / 4))) {
+    if (!decide_allocation (gzdec, size))
+      return GST_FLOW_ERROR;
+  }
+
+  GST_DEBUG_OBJECT (gzdec, "Acquire new output buffer");
+  ret = gst_buffer_pool_acquire_buffer (gzdec->pool, &gzdec->out_buf, NULL);
+  if (ret != GST_FLOW_OK)
+    return ret;
+  if (!gst_buffer_map (gzdec->out_buf, &gzdec->out_buf_map, GST_MAP_WRITE)) {
+    gst_buffer_unref (gzdec->out_buf);
+    return GST_FLOW_ERROR;
+  }
+
+  gzdec->new_out_buf = FALSE;
+  gzdec->out_buf_capacity = MIN (size, gzdec->out_buf_map.size);
+  gzdec->out_pts = decoder_time (gzdec);
+
+  gzdec->xz_prepare_out_buffer (gzdec,
+      gzdec->out_buf_map.data, gzdec->out_buf_capacity);
+
+  trace_phase (gzdec, GST_GZDEC_PHASE_ALLOCATE, start);
+  return GST_FLOW_OK;
+}
+
+/* Set the output caps from the type of the first decoded buffer, or none
+ * if nothing was decoded, then send the segment held until then and the
+ * sticky events that came after it, in order */
+static void
+negotiate_output (GstGzdec * gzdec, GstBuffer * buf)
+{
+  GList *events, *l;
+  GstCaps *caps;
+
+  if (gzdec->src_caps_set)
+    return;
+
+  caps = buf ? gst_type_find_helper_for_buffer (GST_OBJECT (gzdec), buf,
+      NULL) : NULL;
+  if (!caps)
+    caps = gst_caps_new_empty_simple ("application/octet-stream");
+  GST_DEBUG_OBJECT (gzdec, "Output caps %" GST_PTR_FORMAT, caps);
+  gst_pad_set_caps (gzdec->srcpad, caps);
+  gst_caps_unref (caps);
+  gzdec->src_caps_set = TRUE;
+
+  if (gzdec->pending_segment) {
+    gst_pad_push_event (gzdec->srcpad, gzdec->pending_segment);
+    gzdec->pending_segment = NULL;
+  }
+  events = gzdec->pending_events;
+  gzdec->pending_events = NULL;
+  for (l = events; l; l = l->next)
+    gst_pad_push_event (gzdec->srcpad, l->data);
+  g_list_free (events);
+
+  // The buffer pool was chosen without caps
+  gst_pad_mark_reconfigure (gzdec->srcpad);
+}
+
+/* Push the input regions passed through, if any */
+static GstFlowReturn
+push_passthrough (GstGzdec * gzdec)
+{
+  GstBuffer *buf = gzdec->pt_buf;
+  GstClockTime start;
+  GstFlowReturn ret;
+
+  if (!buf)
+    return GST_FLOW_OK;
+
+  gzdec->pt_buf = NULL;
+  negotiate_output (gzdec, buf);
+  stamp_buffer (gzdec, buf, gzdec->pt_pts);
+  gzdec->stats_pending.bytes_out += gst_buffer_get_size (buf);
+  gzdec->stats_pending.buffers_out++;
+
+  start = TRACE_START (gzdec);
+  ret = gst_pad_push (gzdec->srcpad, buf);
+  trace_phase (gzdec, GST_GZDEC_PHASE_PUSH, start);
+  return ret;
+}
+
+/* Queue the input region of the last stored block. Consecutive regions are
+ * gathered in a single buffer, up to its maximum number of memories */
+static GstFlowReturn
+passthrough (GstGzdec * gzdec, GstBuffer * in_buf)
+{
+  GstFlowReturn ret;
+
+  // The data decoded before goes first
+  if (!gzdec->new_out_buf && gzdec->xz_out_buffer_size (gzdec) > 0) {
+    ret = push_out_buf (gzdec);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  GST_LOG_OBJECT (gzdec, "Pass through %" G_GSIZE_FORMAT " bytes at %"
+      G_GSIZE_FORMAT, gzdec->pt_len, gzdec->pt_offset);
+  if (!gzdec->pt_buf) {
+    gzdec->pt_buf = gst_buffer_copy_region (in_buf, GST_BUFFER_COPY_MEMORY,
+        gzdec->pt_offset, gzdec->pt_len);
+    gzdec->pt_pts = input_time (gzdec, gzdec->pt_offset);
+  } else
+    gzdec->pt_buf = gst_buffer_append_region (gzdec->pt_buf,
+        gst_buffer_ref (in_buf), gzdec->pt_offset, gzdec->pt_len);
+
+  if (gst_buffer_n_memory (gzdec->pt_buf) >= gst_buffer_get_max_memory ())
+    return push_passthrough (gzdec);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+push_out_buf (GstGzdec * gzdec)
+{
+  GstClockTime start;
+  GstFlowReturn ret;
+
+  gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
+  gzdec->new_out_buf = TRUE;
+
+  // Stored blocks passed through come before the data decoded after them
+  ret = push_passthrough (gzdec);
+  if (ret != GST_FLOW_OK) {
+    gst_buffer_unref (gzdec->out_buf);
+    return ret;
+  }
+
+  gst_buffer_set_size (gzdec->out_buf, gzdec->xz_out_buffer_size (gzdec));
+  negotiate_output (gzdec, gzdec->out_buf);
+  stamp_buffer (gzdec, gzdec->out_buf, gzdec->out_pts);
+  gzdec->stats_pending.bytes_out += gst_buffer_get_size (gzdec->out_buf);
+  gzdec->stats_pending.buffers_out++;
+
+  start = TRACE_START (gzdec);
+  ret = gst_pad_push (gzdec->srcpad, gzdec->out_buf);
+  trace_phase (gzdec, GST_GZDEC_PHASE_PUSH, start);
+  return ret;
+}
+
+/* Push the pending output buffer, if it holds any data */
+static GstFlowReturn
+flush_out_buf (GstGzdec * gzdec)
+{
+  if (gzdec->new_out_buf)
+    return push_passthrough (gzdec);
+
+  if (gzdec->xz_out_buffer_size (gzdec) > 0)
+    return push_out_buf (gzdec);
+
+  gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
+  gst_buffer_unref (gzdec->out_buf);
+  gzdec->new_out_buf = TRUE;
+  return push_passthrough (gzdec);
+}
+
+/* Decode the data still held by the backend once no more input will come,
+ * and push the pending output buffer */
+static GstFlowReturn
+drain_decoder (GstGzdec * gzdec)
+{
+  GstFlowReturn ret;
+  int xz_ret;
+
+  if (!gzdec->xz_drain)
+    return flush_out_buf (gzdec);
+
+  gzdec->xz_drain (gzdec);
+  do {
+    ret = prepare_out_buffer (gzdec, gzdec->last_in_size);
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    xz_ret = uncompress_step (gzdec);
+    if (xz_ret & XZ_ERROR) {
+      gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
+      gst_buffer_unref (gzdec->out_buf);
+      gzdec->new_out_buf = TRUE;
+      return GST_FLOW_ERROR;
+    }
+
+    if (xz_ret & XZ_MORE_OUTPUT) {
+      ret = push_out_buf (gzdec);
+      if (ret != GST_FLOW_OK)
+        return ret;
+    }
+  } while (!(xz_ret & (XZ_END | XZ_MORE_INPUT)));
+
+  return flush_out_buf (gzdec);
+}
+
+/* Push the output decoded so far when it has waited for max-latency, or will
+ * have by the time decoding goes on, @wait from now. Without a decode
+ * thread nothing runs until the next input buffer, so @wait is the gap
+ * between the last two of them. NONE means the input ran dry */
+static GstFlowReturn
+push_overdue (GstGzdec * gzdec, GstClockTime wait)
+{
+  GstClockTime max_latency, waited;
+
+  if (gzdec->new_out_buf || gzdec->xz_out_buffer_size (gzdec) == 0)
+    return GST_FLOW_OK;
+
+  GST_OBJECT_LOCK (gzdec);
+  max_latency = gzdec->max_latency;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (max_latency == 0)
+    return GST_FLOW_OK;
+
+  waited = gst_util_get_timestamp () - gzdec->out_since;
+  if (GST_CLOCK_TIME_IS_VALID (wait) && waited + wait < max_latency)
+    return GST_FLOW_OK;
+
+  GST_LOG_OBJECT (gzdec, "Pushing %" G_GSIZE_FORMAT " bytes decoded %"
+      GST_TIME_FORMAT " ago", gzdec->xz_out_buffer_size (gzdec),
+      GST_TIME_ARGS (waited));
+  return push_out_buf (gzdec);
+}
+
+/* Drop the pending output and bring the backend back to the start of a
+ * stream after a flush, keeping its state allocated */
+static void
+flush_decoder (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "Flushing");
+
+  if (!gzdec->new_out_buf) {
+    gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
+    gst_buffer_unref (gzdec->out_buf);
+    gzdec->new_out_buf = TRUE;
+  }
+  if (gzdec->pt_buf) {
+    gst_buffer_unref (gzdec->pt_buf);
+    gzdec->pt_buf = NULL;
+  }
+  if (gzdec->sniff_buf) {
+    gst_buffer_unref (gzdec->sniff_buf);
+    gzdec->sniff_buf = NULL;
+  }
+
+  // Set up again from the next buffer when the backend can't be reset
+  if (gzdec->xz_initialized && gzdec->xz_reset (gzdec) != 0) {
+    GST_WARNING_OBJECT (gzdec, "Failed to reset the decoder");
+    gzdec->xz_free (gzdec);
+    gzdec->xz_initialized = FALSE;
+    GST_OBJECT_LOCK (gzdec);
+    gzdec->raw_restart = FALSE;
+    GST_OBJECT_UNLOCK (gzdec);
+  }
+  gzdec->seek_restart = NULL;
+  gzdec->seek_discard = 0;
+
+  gzdec->members = 0;
+  gzdec->member_out = 0;
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->total_out = 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  gzdec->last_in_time = GST_CLOCK_TIME_NONE;
+  gzdec->in_gap = GST_CLOCK_TIME_NONE;
+  reset_timestamps (gzdec);
+}
+
+/* Byte segment of the decoded stream replacing a byte segment of the
+ * compressed one. It starts at the offset of the next output buffer */
+static GstEvent *
+output_segment (GstGzdec * gzdec, GstEvent * event)
+{
+  const GstSegment *in_segment;
+  GstSegment segment;
+  GstEvent *out;
+  gint64 duration;
+
+  gst_event_parse_segment (event, &in_segment);
+  if (in_segment->format != GST_FORMAT_BYTES)
+    return event;
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  segment.flags = in_segment->flags;
+  segment.rate = in_segment->rate;
+  segment.applied_rate = in_segment->applied_rate;
+  segment.start = gzdec->total_out;
+  segment.time = gzdec->total_out;
+  segment.position = gzdec->total_out;
+  duration = get_duration (gzdec);
+  if (duration >= 0)
+    segment.duration = duration;
+
+  GST_DEBUG_OBJECT (gzdec, "Output %" GST_SEGMENT_FORMAT, &segment);
+  out = gst_event_new_segment (&segment);
+  gst_event_set_seqnum (out, gst_event_get_seqnum (event));
+  gst_event_unref (event);
+  return out;
+}
+
+/* Guess the compressed format from the first bytes of the stream */
+static GstGzdecFormat
+sniff_format (const guint8 * data, gsize size)
+{
+  if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+    return GST_GZDEC_FORMAT_GZIP;
+  if (size >= 4 && data[0] == 'B' && data[1] == 'Z' && data[2] == 'h'
+      && data[3] >= '1' && data[3] <= '9')
+    return GST_GZDEC_FORMAT_BZIP2;
+  if (size >= 4 && GST_READ_UINT32_LE (data) == 0xfd2fb528)
+    return GST_GZDEC_FORMAT_ZSTD;
+  if (size >= 6 && memcmp (data, "\3757zXZ\0", 6) == 0)
+    return GST_GZDEC_FORMAT_XZ;
+  if (size >= 4 && GST_READ_UINT32_LE (data) == 0x184d2204)
+    return GST_GZDEC_FORMAT_LZ4;
+
+  // Deflate, a window of 32 KiB at most, no preset dictionary and the
+  // header check
+  if (size >= 2 && (data[0] & 0x0f) == 8 && (data[0] >> 4) <= 7
+      && !(data[1] & 0x20) && ((data[0] << 8) | data[1]) % 31 == 0)
+    return GST_GZDEC_FORMAT_ZLIB;
+
+  return GST_GZDEC_FORMAT_AUTO;
+}
+
+static GstGzdecFormat
+format_from_caps (GstCaps * caps)
+{
+  const gchar *mtype;
+
+  if (gst_caps_is_empty (caps) || gst_caps_is_any (caps))
+    return GST_GZDEC_FORMAT_AUTO;
+
+  mtype = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_equal (mtype, "application/x-gzip"))
+    return GST_GZDEC_FORMAT_GZIP;
+  if (g_str_equal (mtype, "application/x-bzip"))
+    return GST_GZDEC_FORMAT_BZIP2;
+  if (g_str_equal (mtype, "application/x-zlib"))
+    return GST_GZDEC_FORMAT_ZLIB;
+  if (g_str_equal (mtype, "application/x-deflate"))
+    return GST_GZDEC_FORMAT_DEFLATE;
+  if (g_str_equal (mtype, "application/zstd"))
+    return GST_GZDEC_FORMAT_ZSTD;
+  if (g_str_equal (mtype, "application/x-xz"))
+    return GST_GZDEC_FORMAT_XZ;
+  if (g_str_equal (mtype, "application/x-lz4"))
+    return GST_GZDEC_FORMAT_LZ4;
+  return GST_GZDEC_FORMAT_AUTO;
+}
+
+/* Start the backend for the format set, or the one found in the first
+ * buffer of the stream */
+static gboolean
+start_decoder (GstGzdec * gzdec, GstBuffer * buf)
+{
+  GstGzdecFormat format;
+  guint8 head[SNIFF_SIZE];
+  gsize size;
+
+  GST_OBJECT_LOCK (gzdec);
+  format = gzdec->format;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (format == GST_GZDEC_FORMAT_AUTO) {
+    size = gst_buffer_extract (buf, 0, head, SNIFF_SIZE);
+    format = sniff_format (head, size);
+
+    // Raw deflate has no header, only the caps can tell it from garbage
+    if (format == GST_GZDEC_FORMAT_AUTO)
+      format = gzdec->caps_format != GST_GZDEC_FORMAT_AUTO ?
+          gzdec->caps_format : GST_GZDEC_FORMAT_DEFLATE;
+  }
+
+  GST_INFO_OBJECT (gzdec, "Input format %d", format);
+  return xzlib_init (gzdec, format);
+}
+
+/* Decode at once a gzip member starting at @data, into a buffer of the
+ * size given by the trailer at the end of @data. Those last bytes are only
+ * the member's trailer when it ends with @data, which only decoding tells:
+ * the member must end before the output buffer is full. That buffer is no
+ * larger than max-buffer-size, bounding the work lost otherwise. Returns
+ * the input bytes used, or 0 when they aren't a whole member and must be
+ * streamed */
+static gsize
+decode_whole_member (GstGzdec * gzdec, const guint8 * data, gsize size,
+    GstBuffer ** out_buf)
+{
+  GstBuffer *buf;
+  GstMapInfo map;
+  guint32 isize;
+  guint max_size;
+  size_t in_used, out_used;
+  gboolean ok;
+
+  if (size < GZIP_MIN_MEMBER || data[0] != 0x1f || data[1] != 0x8b
+      || data[2] != Z_DEFLATED)
+    return 0;
+
+  GST_OBJECT_LOCK (gzdec);
+  max_size = gzdec->max_buffer_size;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  isize = GST_READ_UINT32_LE (data + size - 4);
+  if (isize == 0 || isize > size * DEFLATE_MAX_RATIO || isize > max_size)
+    return 0;
+
+  buf = gst_buffer_new_allocate (NULL, isize, NULL);
+  if (!buf) {
+    GST_DEBUG_OBJECT (gzdec, "Can't allocate %u bytes, streaming", isize);
+    return 0;
+  }
+  if (!gst_buffer_map (buf, &map, GST_MAP_WRITE)) {
+    gst_buffer_unref (buf);
+    return 0;
+  }
+
+#ifdef HAVE_LIBDEFLATE
+  if (!gzdec->whole_dec)
+    gzdec->whole_dec = libdeflate_alloc_decompressor ();
+  // Success means the member ended, at in_used, within the output buffer
+  ok = gzdec->whole_dec && libdeflate_gzip_decompress_ex (gzdec->whole_dec,
+      data, size, map.data, map.size, &in_used, &out_used)
+      == LIBDEFLATE_SUCCESS && in_used <= size;
+#else
+  gzdec->zstrm->next_in = (Bytef *) data;
+  gzdec->zstrm->avail_in = size;
+  gzdec->zstrm->next_out = map.data;
+  gzdec->zstrm->avail_out = map.size;
+  ok = inflate (gzdec->zstrm, Z_FINISH) == Z_STREAM_END;
+  in_used = size - gzdec->zstrm->avail_in;
+  out_used = map.size - gzdec->zstrm->avail_out;
+  // Back at the start of a member, to stream it or for the next one
+  zlib_reset (gzdec);
+#endif
+  gst_buffer_unmap (buf, &map);
+
+  if (!ok) {
+    GST_LOG_OBJECT (gzdec, "Not a whole member, streaming it");
+    gst_buffer_unref (buf);
+    return 0;
+  }
+
+  GST_LOG_OBJECT (gzdec, "Whole member: %" G_GSIZE_FORMAT " -> %"
+      G_GSIZE_FORMAT " bytes", in_used, out_used);
+  gst_buffer_set_size (buf, out_used);
+  *out_buf = buf;
+  return in_used;
+}
+
+static GstFlowReturn
+decode_buffer (GstGzdec * gzdec, GstBuffer * in_buf)
+{
+  GstMapInfo in_buf_map;
+  GstFlowReturn ret = GST_FLOW_ERROR;
+  GstBuffer *member;
+  GstClockTime start, step_start, elapsed;
+  size_t filled, produced;
+  gsize used = 0;
+  int xz_ret;
+
+  start = gst_util_get_timestamp ();
+
+  // Pick the backend once enough bytes have been seen
+  if (!gzdec->xz_initialized) {
+    if (gzdec->sniff_buf) {
+      in_buf = gst_buffer_append (gzdec->sniff_buf, in_buf);
+      gzdec->sniff_buf = NULL;
+    }
+    if (gst_buffer_get_size (in_buf) < SNIFF_SIZE) {
+      gzdec->sniff_buf = in_buf;
+      return GST_FLOW_OK;
+    }
+    if (!start_decoder (gzdec, in_buf)) {
+      GST_ELEMENT_ERROR (gzdec, LIBRARY, INIT, (NULL),
+          ("Failed to initialize the decoder"));
+      gst_buffer_unref (in_buf);
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  GST_DEBUG_OBJECT (gzdec, "New input buffer");
+  step_start = TRACE_START (gzdec);
+  if (!gst_buffer_map (in_buf, &in_buf_map, GST_MAP_READ))
+    goto free_in;
+  trace_phase (gzdec, GST_GZDEC_PHASE_MAP, step_start);
+
+  gzdec->last_in_size = in_buf_map.size;
+  input_timestamps (gzdec, in_buf, in_buf_map.size);
+  if (GST_CLOCK_TIME_IS_VALID (gzdec->last_in_time))
+    gzdec->in_gap = start - gzdec->last_in_time;
+  gzdec->last_in_time = start;
+  gzdec->stats_pending.bytes_in += in_buf_map.size;
+  gzdec->stats_pending.buffers_in++;
+
+  // A gzip member starting the buffer may end with it. Decoding it at once
+  // allocates the output only once. Not when a seek went past its start
+  if (gzdec->whole_member && gzdec->zstrm->total_in == 0
+      && !gzdec->seek_restart && !gzdec->zlib_raw
+      && gzdec->seek_discard == 0) {
+    step_start = gst_util_get_timestamp ();
+    used = decode_whole_member (gzdec, in_buf_map.data, in_buf_map.size,
+        &member);
+    elapsed = gst_util_get_timestamp () - step_start;
+    gzdec->stats_pending.decode_time += elapsed;
+    if (gzdec->latency)
+      gst_gzdec_latency_add (gzdec->latency, GST_GZDEC_PHASE_INFLATE,
+          elapsed);
+  }
+  if (used > 0) {
+    // The data decoded before goes first
+    if (!gzdec->new_out_buf && gzdec->xz_out_buffer_size (gzdec) > 0) {
+      ret = push_out_buf (gzdec);
+      if (ret != GST_FLOW_OK) {
+        gst_buffer_unref (member);
+        goto unmap_in;
+      }
+    }
+
+    gzdec->ratio_out += gst_buffer_get_size (member);
+    gzdec->members++;
+    gzdec->member_out = 0;
+    gzdec->pt_buf = member;
+    gzdec->pt_pts = gzdec->in_pts;
+    ret = push_passthrough (gzdec);
+    if (ret != GST_FLOW_OK)
+      goto unmap_in;
+    if (!gzdec->multi_member)
+      goto finish;
+    if (used == in_buf_map.size)
+      goto done;
+  }
+
+  gzdec->xz_prepare_in_buffer (gzdec, in_buf_map.data + used,
+      in_buf_map.size - used);
+
+  // Keep decompressing and pushing buffers until finish, error or input exhaust
+  do {
+    // Allocate new output buffer if necessary
+    ret = prepare_out_buffer (gzdec, in_buf_map.size);
+    if (ret != GST_FLOW_OK)
+      goto unmap_in;
+
+    // Uncompress until error, input exhaust, output full or finish
+    GST_DEBUG_OBJECT (gzdec, "Uncompress step");
+    filled = gzdec->xz_out_buffer_size (gzdec);
+    xz_ret = uncompress_step (gzdec);
+
+    if (xz_ret & XZ_ERROR) {
+      // Like gzip, ignore garbage (e.g. padding) after the last member
+      if (gzdec->multi_member && gzdec->members > 0
+          && gzdec->member_out == 0) {
+        GST_WARNING_OBJECT (gzdec, "Trailing garbage after %u members "
+            "ignored", gzdec->members);
+        goto finish;
+      }
+      ret = GST_FLOW_ERROR;
+      goto free_out;
+    }
+
+    produced = gzdec->xz_out_buffer_size (gzdec) - filled;
+    gzdec->ratio_out += produced;
+    if (filled == 0 && produced > 0)
+      gzdec->out_since = gst_util_get_timestamp ();
+    gzdec->member_out += produced;
+
+    // A stored block went by, push it as a region of the input buffer
+    if (xz_ret & XZ_PASSTHROUGH) {
+      ret = passthrough (gzdec, in_buf);
+      if (ret != GST_FLOW_OK)
+        goto unmap_in;
+      gzdec->member_out += gzdec->pt_len;
+    }
+
+    // Output buffer is full, push it and continue
+    if (xz_ret & XZ_MORE_OUTPUT) {
+      GST_DEBUG_OBJECT (gzdec, "Out buffer ready. Push it");
+      ret = push_out_buf (gzdec);
+      if (ret < 0)
+        goto unmap_in;
+    }
+
+    // The backend found the end of the last stream by itself
+    if (xz_ret & XZ_END)
+      goto finish;
+
+    if (xz_ret & XZ_FINISH) {
+      gzdec->members++;
+      // Like the zstd tool, take all the zstd frames as one stream
+      if (!gzdec->multi_member
+          && gzdec->stream_format != GST_GZDEC_FORMAT_ZSTD)
+        goto finish;
+
+      // Start the next member reusing the decoder state
+      GST_DEBUG_OBJECT (gzdec, "End of member %u. Reset decoder",
+          gzdec->members);
+      if (gzdec->xz_reset (gzdec) != 0) {
+        ret = GST_FLOW_ERROR;
+        goto free_out;
+      }
+      gzdec->member_out = 0;
+    }
+  } while (!(xz_ret & XZ_MORE_INPUT));
+
+done:
+  // Update the observed ratio, decaying the history to follow the stream
+  gzdec->ratio_in += in_buf_map.size;
+  if (gzdec->ratio_in > RATIO_WINDOW) {
+    gzdec->ratio_in /= 2;
+    gzdec->ratio_out /= 2;
+  }
+
+  ret = push_passthrough (gzdec);
+  if (ret == GST_FLOW_OK)
+    ret = push_overdue (gzdec, gzdec->task_active ? 0 : gzdec->in_gap);
+  goto unmap_in;
+
+finish:
+  GST_DEBUG_OBJECT (gzdec, "Decompression finish. Send EOS");
+  ret = flush_out_buf (gzdec);
+  if (ret != GST_FLOW_OK)
+    goto unmap_in;
+  gst_pad_push_event (gzdec->srcpad, gst_event_new_eos ());
+  ret = GST_FLOW_EOS;
+  goto unmap_in;
+
+free_out:
+  gst_buffer_unmap (gzdec->out_buf, &gzdec->out_buf_map);
+  gst_buffer_unref (gzdec->out_buf);
+  gzdec->new_out_buf = TRUE;
+unmap_in:
+  if (gzdec->pt_buf) {
+    gst_buffer_unref (gzdec->pt_buf);
+    gzdec->pt_buf = NULL;
+  }
+  gst_buffer_unmap (in_buf, &in_buf_map);
+free_in:
+  gst_buffer_unref (in_buf);
+  stats_update (gzdec, gst_util_get_timestamp () - start,
+      ret == GST_FLOW_EOS);
+  return ret;
+}
+
+/* Time between the first and the last timestamped buffers queued */
+static GstClockTime
+queue_time (GstGzdec * gzdec)
+{
+  GstClockTime first = GST_CLOCK_TIME_NONE;
+  GstClockTime last = GST_CLOCK_TIME_NONE;
+  GstClockTime ts;
+  GList *l;
+
+  for (l = gzdec->queue.head; l; l = l->next) {
+    if (!GST_IS_BUFFER (l->data))
+      continue;
+    ts = GST_BUFFER_DTS_OR_PTS (GST_BUFFER_CAST (l->data));
+    if (!GST_CLOCK_TIME_IS_VALID (ts))
+      continue;
+    if (!GST_CLOCK_TIME_IS_VALID (first))
+      first = ts;
+    last = ts;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (first) || last < first)
+    return 0;
+  return last - first;
+}
+
+/* Whether the input queue is over one of its limits, with the queue lock
+ * held. An empty queue always takes a buffer, however big */
+static gboolean
+queue_is_full (GstGzdec * gzdec)
+{
+  guint max_buffers, max_bytes;
+  guint64 max_time;
+
+  if (gzdec->queue_buffers == 0)
+    return FALSE;
+
+  GST_OBJECT_LOCK (gzdec);
+  max_buffers = gzdec->max_size_buffers;
+  max_bytes = gzdec->max_size_bytes;
+  max_time = gzdec->max_size_time;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (max_buffers > 0 && gzdec->queue_buffers >= max_buffers)
+    return TRUE;
+  if (max_bytes > 0 && gzdec->queue_bytes >= max_bytes)
+    return TRUE;
+  return max_time > 0 && queue_time (gzdec) >= max_time;
+}
+
+/* Hand a buffer or a serialized event to the decode thread, waiting for
+ * room in the queue for buffers. Returns why the thread stopped, if so */
+static GstFlowReturn
+queue_item (GstGzdec * gzdec, GstMiniObject * item)
+{
+  GstFlowReturn ret;
+
+  g_mutex_lock (&gzdec->queue_lock);
+  if (GST_IS_BUFFER (item)) {
+    while (gzdec->queue_result == GST_FLOW_OK && queue_is_full (gzdec))
+      g_cond_wait (&gzdec->queue_cond, &gzdec->queue_lock);
+  }
+
+  ret = gzdec->queue_result;
+  if (ret != GST_FLOW_OK) {
+    g_mutex_unlock (&gzdec->queue_lock);
+    GST_DEBUG_OBJECT (gzdec, "Not queued, decode thread stopped: %s",
+        gst_flow_get_name (ret));
+    gst_mini_object_unref (item);
+    return ret;
+  }
+
+  if (GST_IS_BUFFER (item)) {
+    gzdec->queue_buffers++;
+    gzdec->queue_bytes += gst_buffer_get_size (GST_BUFFER_CAST (item));
+  }
+  g_queue_push_tail (&gzdec->queue, item);
+  g_cond_broadcast (&gzdec->queue_cond);
+  g_mutex_unlock (&gzdec->queue_lock);
+
+  return GST_FLOW_OK;
+}
+
+/* Decode thread, running the queued buffers and events in order */
+static void
+decode_loop (GstPad * pad)
+{
+  GstGzdec *gzdec = GST_GZDEC (GST_PAD_PARENT (pad));
+  GstMiniObject *item;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean dry;
+
+  g_mutex_lock (&gzdec->queue_lock);
+  while (gzdec->queue_result == GST_FLOW_OK
+      && g_queue_is_empty (&gzdec->queue))
+    g_cond_wait (&gzdec->queue_cond, &gzdec->queue_lock);
+  if (gzdec->queue_result != GST_FLOW_OK) {
+    g_mutex_unlock (&gzdec->queue_lock);
+    gst_pad_pause_task (pad);
+    return;
+  }
+
+  item = g_queue_pop_head (&gzdec->queue);
+  if (GST_IS_BUFFER (item)) {
+    gzdec->queue_buffers--;
+    gzdec->queue_bytes -= gst_buffer_get_size (GST_BUFFER_CAST (item));
+  }
+  g_cond_broadcast (&gzdec->queue_cond);
+  g_mutex_unlock (&gzdec->queue_lock);
+
+  if (GST_IS_BUFFER (item)) {
+    ret = decode_buffer (gzdec, GST_BUFFER_CAST (item));
+
+    // Nothing left to decode, don't hold the output back
+    g_mutex_lock (&gzdec->queue_lock);
+    dry = g_queue_is_empty (&gzdec->queue);
+    g_mutex_unlock (&gzdec->queue_lock);
+    if (ret == GST_FLOW_OK && dry)
+      ret = push_overdue (gzdec, GST_CLOCK_TIME_NONE);
+  } else {
+    if (GST_EVENT_TYPE (item) == GST_EVENT_EOS)
+      ret = GST_FLOW_EOS;
+    gst_gzdec_handle_event (gzdec, GST_EVENT_CAST (item));
+  }
+  if (ret == GST_FLOW_OK)
+    return;
+
+  // Upstream gets the reason on its next buffer
+  GST_DEBUG_OBJECT (gzdec, "Pausing decode thread: %s",
+      gst_flow_get_name (ret));
+  g_mutex_lock (&gzdec->queue_lock);
+  if (gzdec->queue_result == GST_FLOW_OK)
+    gzdec->queue_result = ret;
+  g_cond_broadcast (&gzdec->queue_cond);
+  g_mutex_unlock (&gzdec->queue_lock);
+  gst_pad_pause_task (pad);
+
+  // Errors in our own thread aren't posted by upstream
+  if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS) {
+    GST_ELEMENT_ERROR (gzdec, STREAM, FAILED,
+        ("Internal data stream error."),
+        ("streaming stopped, reason %s (%d)", gst_flow_get_name (ret), ret));
+    gst_pad_push_event (gzdec->srcpad, gst_event_new_eos ());
+  }
+}
+
+/* Start the decode thread on push mode activation, when asked for */
+static gboolean
+task_start (GstGzdec * gzdec)
+{
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->task_active = gzdec->decode_thread;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (!gzdec->task_active)
+    return TRUE;
+
+  g_mutex_lock (&gzdec->queue_lock);
+  gzdec->queue_result = GST_FLOW_OK;
+  g_mutex_unlock (&gzdec->queue_lock);
+
+  GST_DEBUG_OBJECT (gzdec, "Starting decode thread");
+  return gst_pad_start_task (gzdec->srcpad, (GstTaskFunction) decode_loop,
+      gzdec->srcpad, NULL);
+}
+
+/* Stop the decode thread and drop the queued input. Buffers still coming
+ * until the sink pad is deactivated are refused */
+static gboolean
+task_stop (GstGzdec * gzdec)
+{
+  GstMiniObject *item;
+  gboolean ret;
+
+  if (!gzdec->task_active)
+    return TRUE;
+
+  // Wake up the thread and any chain waiting for room
+  g_mutex_lock (&gzdec->queue_lock);
+  gzdec->queue_result = GST_FLOW_FLUSHING;
+  g_cond_broadcast (&gzdec->queue_cond);
+  g_mutex_unlock (&gzdec->queue_lock);
+
+  ret = gst_pad_stop_task (gzdec->srcpad);
+
+  g_mutex_lock (&gzdec->queue_lock);
+  while ((item = g_queue_pop_head (&gzdec->queue)))
+    gst_mini_object_unref (item);
+  gzdec->queue_buffers = 0;
+  gzdec->queue_bytes = 0;
+  g_mutex_unlock (&gzdec->queue_lock);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * in_buf)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+
+  if (gzdec->task_active)
+    return queue_item (gzdec, GST_MINI_OBJECT_CAST (in_buf));
+
+  return decode_buffer (gzdec, in_buf);
+}
+
+static gboolean
+gst_gzdec_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+  GQueue flushed = G_QUEUE_INIT;
+  GstEvent *sticky;
+  gboolean ret;
+
+  if (!gzdec->task_active)
+    return gst_gzdec_handle_event (gzdec, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      // Unblock the decode thread pushing downstream or waiting for an
+      // output buffer, then stop it
+      set_pool_flushing (gzdec, TRUE);
+      gst_pad_push_event (gzdec->srcpad, event);
+      g_mutex_lock (&gzdec->queue_lock);
+      gzdec->queue_result = GST_FLOW_FLUSHING;
+      g_cond_broadcast (&gzdec->queue_cond);
+      g_mutex_unlock (&gzdec->queue_lock);
+      gst_pad_pause_task (gzdec->srcpad);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock (&gzdec->queue_lock);
+      flushed = gzdec->queue;
+      g_queue_init (&gzdec->queue);
+      gzdec->queue_buffers = 0;
+      gzdec->queue_bytes = 0;
+      gzdec->queue_result = GST_FLOW_OK;
+      g_mutex_unlock (&gzdec->queue_lock);
+
+      ret = gst_gzdec_handle_event (gzdec, event);
+
+      // The stream keeps the sticky events flushed, but not its position
+      while ((sticky = g_queue_pop_head (&flushed))) {
+        if (GST_IS_EVENT (sticky) && GST_EVENT_IS_STICKY (sticky)
+            && GST_EVENT_TYPE (sticky) != GST_EVENT_SEGMENT
+            && GST_EVENT_TYPE (sticky) != GST_EVENT_EOS)
+          gst_gzdec_handle_event (gzdec, sticky);
+        else
+          gst_mini_object_unref (GST_MINI_OBJECT_CAST (sticky));
+      }
+
+      gst_pad_start_task (gzdec->srcpad, (GstTaskFunction) decode_loop,
+          gzdec->srcpad, NULL);
+      return ret;
+    default:
+      // In order with the buffers around them
+      if (GST_EVENT_IS_SERIALIZED (event))
+        return queue_item (gzdec, GST_MINI_OBJECT_CAST (event))
+            == GST_FLOW_OK;
+      return gst_gzdec_handle_event (gzdec, event);
+  }
+}
+
+/* Handle a sink event, in the upstream streaming thread or in the decode
+ * thread */
+static gboolean
+gst_gzdec_handle_event (GstGzdec * gzdec, GstEvent * event)
+{
+  GstBuffer *buf;
+  GstCaps *caps;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+      // Only a hint, the format is detected from the data. The output caps
+      // are set from the decoded data
+      gst_event_parse_caps (event, &caps);
+      GST_DEBUG_OBJECT (gzdec, "setcaps %" GST_PTR_FORMAT, caps);
+      gzdec->caps_format = format_from_caps (caps);
+      gst_event_unref (event);
+      return TRUE;
+    case GST_EVENT_FLUSH_START:
+      // Without the decode thread, upstream's may wait for a free buffer
+      set_pool_flushing (gzdec, TRUE);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      // The streaming thread is stopped until now, FLUSH_START only
+      // unblocked it. The input after a seek starts a new stream, or at a
+      // checkpoint after a seek of ours
+      set_pool_flushing (gzdec, FALSE);
+      flush_decoder (gzdec);
+      seek_flushed (gzdec, event);
+      break;
+    case GST_EVENT_SEGMENT:
+      event = output_segment (gzdec, event);
+
+      // Sent once the output caps are known
+      if (!gzdec->src_caps_set) {
+        gst_event_replace (&gzdec->pending_segment, event);
+        gst_event_unref (event);
+        return TRUE;
+      }
+      break;
+    case GST_EVENT_EOS:
+      // A stream shorter than the bytes needed to detect its format
+      if (gzdec->sniff_buf) {
+        buf = gzdec->sniff_buf;
+        gzdec->sniff_buf = NULL;
+        if (start_decoder (gzdec, buf))
+          decode_buffer (gzdec, buf);
+        else
+          gst_buffer_unref (buf);
+      }
+
+      // Don't lose the data of truncated or multi-member streams
+      if (gzdec->xz_initialized && drain_decoder (gzdec) == GST_FLOW_ERROR)
+        GST_ELEMENT_ERROR (gzdec, STREAM, DECODE, (NULL),
+            ("Failed to decode the end of the stream"));
+      stats_update (gzdec, 0, TRUE);
+      if (gzdec->latency)
+        gst_gzdec_latency_report (GST_OBJECT_CAST (gzdec), gzdec->latency);
+
+      // CAPS before SEGMENT, even when nothing was decoded
+      negotiate_output (gzdec, NULL);
+      break;
+    default:
+      // Sticky events can't overtake the segment held
+      if (gzdec->pending_segment && GST_EVENT_IS_STICKY (event)) {
+        GST_DEBUG_OBJECT (gzdec, "Holding %s behind the segment",
+            GST_EVENT_TYPE_NAME (event));
+        gzdec->pending_events = g_list_append (gzdec->pending_events, event);
+        return TRUE;
+      }
+      break;
+  };
+
+  return gst_pad_event_default (gzdec->sinkpad, GST_OBJECT_CAST (gzdec),
+      event);
+}
+
+static gboolean
+gst_gzdec_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+  GstFormat format;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEEK:
+      // Byte positions of the decoded stream mean nothing upstream. When
+      // pulling, downstream asks for the offsets it wants by itself
+      gst_event_parse_seek (event, NULL, &format, NULL, NULL, NULL, NULL,
+          NULL);
+      if (format != GST_FORMAT_BYTES)
+        break;
+      if (gzdec->pull_mode) {
+        GST_DEBUG_OBJECT (gzdec, "No byte seeks in pull mode");
+        gst_event_unref (event);
+        return FALSE;
+      }
+      return push_seek (gzdec, event);
+    default:
+      break;
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static gboolean
+gst_gzdec_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+  GstGzdecIndex *index;
+  GstQuery *peer_query;
+  GstFormat format;
+  gint64 duration;
+  guint64 position;
+  gboolean pull, live;
+  GstClockTime min, max, latency;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, NULL);
+      if (format != GST_FORMAT_BYTES)
+        return FALSE;
+      duration = get_duration (gzdec);
+      if (duration < 0)
+        return FALSE;
+      gst_query_set_duration (query, format, duration);
+      return TRUE;
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, NULL);
+      if (format != GST_FORMAT_BYTES)
+        return FALSE;
+      GST_OBJECT_LOCK (gzdec);
+      position = gzdec->pull_mode ? gzdec->pull_out : gzdec->total_out;
+      GST_OBJECT_UNLOCK (gzdec);
+      gst_query_set_position (query, format, position);
+      return TRUE;
+    case GST_QUERY_SEEKING:
+      // Random access in pull mode, or through a complete index in push mode
+      gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+      if (format == GST_FORMAT_BYTES && gzdec->pull_mode) {
+        gst_query_set_seeking (query, format, TRUE, 0, get_duration (gzdec));
+      } else if (format == GST_FORMAT_BYTES && (index = push_index (gzdec))) {
+        gst_query_set_seeking (query, format, TRUE, 0, index->total_out);
+      } else {
+        gst_query_set_seeking (query, format, FALSE, -1, -1);
+      }
+      return TRUE;
+    case GST_QUERY_LATENCY:
+      // Decoded data waits for max-latency at most
+      if (!gst_pad_peer_query (gzdec->sinkpad, query))
+        return FALSE;
+      gst_query_parse_latency (query, &live, &min, &max);
+      GST_OBJECT_LOCK (gzdec);
+      latency = gzdec->max_latency;
+      GST_OBJECT_UNLOCK (gzdec);
+      min += latency;
+      if (GST_CLOCK_TIME_IS_VALID (max))
+        max += latency;
+      GST_DEBUG_OBJECT (gzdec, "Latency: live %d, min %" GST_TIME_FORMAT
+          ", max %" GST_TIME_FORMAT, live, GST_TIME_ARGS (min),
+          GST_TIME_ARGS (max));
+      gst_query_set_latency (query, live, min, max);
+      return TRUE;
+    case GST_QUERY_SCHEDULING:
+      // Random access is possible for gzip input when upstream can do it
+      peer_query = gst_query_new_scheduling ();
+      pull = input_is_gzip (gzdec)
+          && gst_pad_peer_query (gzdec->sinkpad, peer_query)
+          && gst_query_has_scheduling_mode_with_flags (peer_query,
+          GST_PAD_MODE_PULL, GST_SCHEDULING_FLAG_SEEKABLE);
+      gst_query_unref (peer_query);
+
+      gst_query_set_scheduling (query,
+          pull ? GST_SCHEDULING_FLAG_SEEKABLE : 0, 1, -1, 0);
+      if (pull)
+        gst_query_add_scheduling_mode (query, GST_PAD_MODE_PULL);
+      gst_query_add_scheduling_mode (query, GST_PAD_MODE_PUSH);
+      return TRUE;
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+/* Downstream pulling from us makes us pull from upstream. In push mode, the
+ * decode thread runs while the pad is active */
+static gboolean
+gst_gzdec_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+
+  if (mode == GST_PAD_MODE_PUSH)
+    return active ? task_start (gzdec) : task_stop (gzdec);
+  if (mode != GST_PAD_MODE_PULL)
+    return TRUE;
+
+  if (!active) {
+    pull_stop (gzdec);
+    return gst_pad_activate_mode (gzdec->sinkpad, mode, FALSE);
+  }
+
+  if (!gst_pad_activate_mode (gzdec->sinkpad, mode, TRUE))
+    return FALSE;
+  if (!pull_start (gzdec)) {
+    gst_pad_activate_mode (gzdec->sinkpad, mode, FALSE);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Location of the input when it's a local file, from the upstream URI */
+static gchar *
+input_location (GstGzdec * gzdec, GStatBuf * st)
+{
+  GstQuery *query;
+  gchar *uri = NULL;
+  gchar *location = NULL;
+
+  query = gst_query_new_uri ();
+  if (gst_pad_peer_query (gzdec->sinkpad, query))
+    gst_query_parse_uri (query, &uri);
+  gst_query_unref (query);
+  if (uri)
+    location = g_filename_from_uri (uri, NULL, NULL);
+  g_free (uri);
+
+  if (location && g_stat (location, st) != 0) {
+    g_free (location);
+    location = NULL;
+  }
+
+  return location;
+}
+
+/* Decoded size from the gzip trailer, which holds it modulo 2^32. Deflate
+ * expands its input 1032 times at most, so it is the size itself only for
+ * inputs small enough. 0 when the size may be larger. Only the last member
+ * is described, so this is only right for single member inputs */
+static guint64
+trailer_size (guint32 isize, guint64 compressed_size)
+{
+  if (compressed_size > G_MAXUINT32 / 1032)
+    return 0;
+  return isize;
+}
+
+/* Total decoded size, exact once the whole stream has been indexed. The
+ * trailer is only read in pull mode, through upstream */
+static gint64
+get_duration (GstGzdec * gzdec)
+{
+  gboolean multi_member;
+  guint64 duration;
+
+  GST_OBJECT_LOCK (gzdec);
+  if (gzdec->index && gzdec->index->complete) {
+    duration = gzdec->index->total_out;
+    GST_OBJECT_UNLOCK (gzdec);
+    return duration;
+  }
+  multi_member = gzdec->multi_member;
+  duration = gzdec->duration;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (multi_member || duration == 0)
+    return -1;
+
+  return duration;
+}
+
+/* Look for an index file made for the input file with @flags */
+static GstGzdecIndex *
+load_index (GstGzdec * gzdec, guint flags)
+{
+  GStatBuf st;
+  gchar *location;
+  gchar *path;
+  gboolean use;
+
+  GST_OBJECT_LOCK (gzdec);
+  use = gzdec->use_index_file;
+  path = g_strdup (gzdec->index_file);
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (!use) {
+    g_free (path);
+    return NULL;
+  }
+
+  // The input file is needed to know if the index is still valid
+  location = input_location (gzdec, &st);
+  if (!location) {
+    GST_DEBUG_OBJECT (gzdec, "Input isn't a local file, no index file used");
+    g_free (path);
+    return NULL;
+  }
+
+  if (!path)
+    path = g_strconcat (location, ".gzidx", NULL);
+  g_free (location);
+
+  g_free (gzdec->index_path);
+  gzdec->index_path = path;
+  gzdec->src_size = st.st_size;
+  gzdec->src_mtime = st.st_mtime;
+  return gst_gzdec_index_load (path, gzdec->src_size, gzdec->src_mtime,
+      flags);
+}
+
+/* Complete index to seek with in push mode, looked for the first time it's
+ * needed. Only with a backend that can restart at its checkpoints */
+static GstGzdecIndex *
+push_index (GstGzdec * gzdec)
+{
+  GstGzdecIndex *index;
+  gboolean load;
+  guint flags;
+
+  GST_OBJECT_LOCK (gzdec);
+  index = gzdec->raw_restart ? gzdec->index : NULL;
+  load = gzdec->raw_restart && !gzdec->index_tried;
+  gzdec->index_tried |= load;
+  flags = gzdec->multi_member ? GST_GZDEC_INDEX_MULTI_MEMBER : 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (!load)
+    return index;
+
+  index = load_index (gzdec, flags);
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->index = index;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  return index;
+}
+
+/* Seek upstream for a byte position of the decoded stream. The start is the
+ * start of the input, other positions need a complete index: decoding
+ * restarts at the checkpoint before them, dropping the bytes in between */
+static gboolean
+push_seek (GstGzdec * gzdec, GstEvent * event)
+{
+  const GstGzdecCheckpoint *point = NULL;
+  GstGzdecIndex *index;
+  GstSeekType start_type, stop_type;
+  GstSeekFlags flags;
+  GstEvent *seek;
+  gint64 start, stop;
+  guint64 in = 0;
+  gdouble rate;
+  guint32 seqnum;
+  gboolean ret;
+
+  gst_event_parse_seek (event, &rate, NULL, &flags, &start_type, &start,
+      &stop_type, &stop);
+  seqnum = gst_event_get_seqnum (event);
+  gst_event_unref (event);
+
+  // The decoder restarts at the FLUSH_STOP, and can't stop on its own
+  if (!(flags & GST_SEEK_FLAG_FLUSH) || rate != 1.0
+      || start_type != GST_SEEK_TYPE_SET || start < 0
+      || (stop_type != GST_SEEK_TYPE_NONE && stop != -1)) {
+    GST_DEBUG_OBJECT (gzdec, "Only flushing seeks to a position are handled");
+    return FALSE;
+  }
+
+  if (start > 0) {
+    index = push_index (gzdec);
+    if (!index || (guint64) start >= index->total_out) {
+      GST_DEBUG_OBJECT (gzdec, "Can't seek to %" G_GINT64_FORMAT " without "
+          "a complete index", start);
+      return FALSE;
+    }
+    point = gst_gzdec_index_lookup (index, start);
+    if (point)
+      in = point->in - (point->bits ? 1 : 0);
+  }
+
+  GST_DEBUG_OBJECT (gzdec, "Seeking to %" G_GINT64_FORMAT ", %"
+      G_GUINT64_FORMAT " compressed", start, in);
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->seek_pending = TRUE;
+  gzdec->seek_seqnum = seqnum;
+  gzdec->seek_point = point;
+  gzdec->seek_offset = start;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  seek = gst_event_new_seek (rate, GST_FORMAT_BYTES, flags,
+      GST_SEEK_TYPE_SET, in, GST_SEEK_TYPE_NONE, -1);
+  gst_event_set_seqnum (seek, seqnum);
+  ret = gst_pad_push_event (gzdec->sinkpad, seek);
+  if (!ret) {
+    GST_OBJECT_LOCK (gzdec);
+    gzdec->seek_pending = FALSE;
+    GST_OBJECT_UNLOCK (gzdec);
+  }
+
+  return ret;
+}
+
+/* Once the decoder is flushed by a seek of ours, the decoded stream goes on
+ * from the position sought */
+static void
+seek_flushed (GstGzdec * gzdec, GstEvent * event)
+{
+  const GstGzdecCheckpoint *point;
+
+  GST_OBJECT_LOCK (gzdec);
+  if (gzdec->seek_pending
+      && gzdec->seek_seqnum == gst_event_get_seqnum (event)) {
+    point = gzdec->seek_point;
+    gzdec->seek_pending = FALSE;
+    gzdec->seek_restart = point;
+    gzdec->seek_discard = gzdec->seek_offset - (point ? point->out : 0);
+    gzdec->total_out = gzdec->seek_offset;
+  }
+  GST_OBJECT_UNLOCK (gzdec);
+}
+
+/* Whether the input is known to be gzip before pulling anything, from the
+ * format set or else from the caps upstream can produce. Only then can
+ * pull mode be offered, as pull_start() refuses anything else. */
+static gboolean
+input_is_gzip (GstGzdec * gzdec)
+{
+  GstGzdecFormat format;
+  GstCaps *caps;
+  gboolean gzip;
+
+  GST_OBJECT_LOCK (gzdec);
+  format = gzdec->format;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (format != GST_GZDEC_FORMAT_AUTO)
+    return format == GST_GZDEC_FORMAT_GZIP;
+
+  caps = gst_pad_peer_query_caps (gzdec->sinkpad, NULL);
+  gzip = gst_caps_is_fixed (caps)
+      && format_from_caps (caps) == GST_GZDEC_FORMAT_GZIP;
+  gst_caps_unref (caps);
+  return gzip;
+}
+
+static gboolean
+pull_start (GstGzdec * gzdec)
+{
+  GstBuffer *buf = NULL;
+  guint8 magic[2];
+  guint8 trailer[4];
+  gint64 size;
+  guint64 duration;
+  GstGzdecFormat format;
+  guint flags;
+  GstGzdecIndex *index;
+
+  // Only gzip streams can be restarted in the middle
+  GST_OBJECT_LOCK (gzdec);
+  format = gzdec->format;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (format != GST_GZDEC_FORMAT_AUTO && format != GST_GZDEC_FORMAT_GZIP) {
+    GST_DEBUG_OBJECT (gzdec, "Format %d set, can't work in pull mode", format);
+    return FALSE;
+  }
+  if (gst_pad_pull_range (gzdec->sinkpad, 0, 2, &buf) != GST_FLOW_OK)
+    return FALSE;
+  if (gst_buffer_extract (buf, 0, magic, 2) != 2 || magic[0] != 0x1f
+      || magic[1] != 0x8b) {
+    GST_DEBUG_OBJECT (gzdec, "Not a gzip stream, can't work in pull mode");
+    gst_buffer_unref (buf);
+    return FALSE;
+  }
+  gst_buffer_unref (buf);
+
+  memset (&gzdec->pull_zstrm, 0, sizeof (gzdec->pull_zstrm));
+  if (inflateInit2 (&gzdec->pull_zstrm, MAX_WBITS + 16) != Z_OK)
+    return FALSE;
+
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->pull_interval = gzdec->index_interval;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  // The size from the trailer, known before decoding anything
+  duration = 0;
+  if (gst_pad_peer_query_duration (gzdec->sinkpad, GST_FORMAT_BYTES,
+          &size) && size >= 18
+      && gst_pad_pull_range (gzdec->sinkpad, size - 4, 4, &buf) ==
+      GST_FLOW_OK) {
+    if (gst_buffer_extract (buf, 0, trailer, 4) == 4)
+      duration = trailer_size (GST_READ_UINT32_LE (trailer), size);
+    gst_buffer_unref (buf);
+  }
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->duration = duration;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  GST_DEBUG_OBJECT (gzdec, "Working in pull mode");
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->pull_mode = TRUE;
+  gzdec->pull_out = 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  gzdec->pull_raw = FALSE;
+  gzdec->pull_skip = 0;
+  gzdec->pull_done = FALSE;
+  gzdec->pull_buf = NULL;
+  gzdec->pull_in = 0;
+  gzdec->pull_scratch = g_malloc (PULL_SCRATCH_SIZE);
+
+  // The decoded stream, and so the index, depend on multi-member
+  GST_OBJECT_LOCK (gzdec);
+  flags = gzdec->multi_member ? GST_GZDEC_INDEX_MULTI_MEMBER : 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  index = load_index (gzdec, flags);
+  if (!index) {
+    index = gst_gzdec_index_new ();
+    index->flags = flags;
+  }
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->index = index;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  return TRUE;
+}
+
+static void
+pull_release_input (GstGzdec * gzdec)
+{
+  if (gzdec->pull_buf) {
+    gst_buffer_unmap (gzdec->pull_buf, &gzdec->pull_map);
+    gst_buffer_unref (gzdec->pull_buf);
+    gzdec->pull_buf = NULL;
+  }
+  gzdec->pull_zstrm.next_in = Z_NULL;
+  gzdec->pull_zstrm.avail_in = 0;
+}
+
+static void
+pull_stop (GstGzdec * gzdec)
+{
+  GstGzdecIndex *index;
+
+  if (!gzdec->pull_mode)
+    return;
+
+  pull_release_input (gzdec);
+  inflateEnd (&gzdec->pull_zstrm);
+  g_free (gzdec->pull_scratch);
+  gzdec->pull_scratch = NULL;
+  // Queries read the index under the object lock
+  GST_OBJECT_LOCK (gzdec);
+  index = gzdec->index;
+  gzdec->index = NULL;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (index)
+    gst_gzdec_index_free (index);
+  g_free (gzdec->index_path);
+  gzdec->index_path = NULL;
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->pull_mode = FALSE;
+  GST_OBJECT_UNLOCK (gzdec);
+}
+
+/* The whole stream was decoded, so the index is complete */
+static void
+pull_end (GstGzdec * gzdec)
+{
+  gzdec->pull_done = TRUE;
+  if (gzdec->index->complete)
+    return;
+
+  GST_DEBUG_OBJECT (gzdec, "End of stream at %" G_GUINT64_FORMAT,
+      gzdec->pull_out);
+  gst_gzdec_index_set_complete (gzdec->index, gzdec->pull_out);
+  if (gzdec->index_path)
+    gst_gzdec_index_save (gzdec->index, gzdec->index_path, gzdec->src_size,
+        gzdec->src_mtime);
+}
+
+/* Pull the next chunk of compressed data */
+static GstFlowReturn
+pull_input (GstGzdec * gzdec)
+{
+  GstFlowReturn ret;
+
+  pull_release_input (gzdec);
+  ret = gst_pad_pull_range (gzdec->sinkpad, gzdec->pull_in, PULL_CHUNK_SIZE,
+      &gzdec->pull_buf);
+  if (ret != GST_FLOW_OK) {
+    gzdec->pull_buf = NULL;
+    return ret;
+  }
+
+  if (!gst_buffer_map (gzdec->pull_buf, &gzdec->pull_map, GST_MAP_READ)) {
+    gst_buffer_unref (gzdec->pull_buf);
+    gzdec->pull_buf = NULL;
+    return GST_FLOW_ERROR;
+  }
+  if (gzdec->pull_map.size == 0) {
+    pull_release_input (gzdec);
+    return GST_FLOW_EOS;
+  }
+
+  gzdec->pull_zstrm.next_in = gzdec->pull_map.data;
+  gzdec->pull_zstrm.avail_in = gzdec->pull_map.size;
+  gzdec->pull_in += gzdec->pull_map.size;
+
+  return GST_FLOW_OK;
+}
+
+/* Restart decoding at @point, or at the start of the stream if NULL */
+static GstFlowReturn
+pull_seek (GstGzdec * gzdec, const GstGzdecCheckpoint * point)
+{
+  GstFlowReturn ret;
+  guint8 prev_byte = 0;
+
+  pull_release_input (gzdec);
+  gzdec->pull_skip = 0;
+  gzdec->pull_done = FALSE;
+
+  if (!point) {
+    GST_DEBUG_OBJECT (gzdec, "Restart from the beginning");
+    gzdec->pull_in = 0;
+    GST_OBJECT_LOCK (gzdec);
+    gzdec->pull_out = 0;
+    GST_OBJECT_UNLOCK (gzdec);
+    gzdec->pull_raw = FALSE;
+    if (inflateReset2 (&gzdec->pull_zstrm, MAX_WBITS + 16) != Z_OK)
+      return GST_FLOW_ERROR;
+    return GST_FLOW_OK;
+  }
+
+  GST_DEBUG_OBJECT (gzdec, "Restart from checkpoint at %" G_GUINT64_FORMAT,
+      point->out);
+  gzdec->pull_in = point->in - (point->bits ? 1 : 0);
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->pull_out = point->out;
+  GST_OBJECT_UNLOCK (gzdec);
+  gzdec->pull_raw = TRUE;
+
+  // The checkpoint may start in the middle of a byte
+  if (point->bits) {
+    ret = pull_input (gzdec);
+    if (ret != GST_FLOW_OK)
+      return ret;
+    prev_byte = gzdec->pull_zstrm.next_in[0];
+    gzdec->pull_zstrm.next_in++;
+    gzdec->pull_zstrm.avail_in--;
+  }
+
+  if (gst_gzdec_index_restore (point, &gzdec->pull_zstrm, prev_byte) != Z_OK)
+    return GST_FLOW_ERROR;
+
+  return GST_FLOW_OK;
+}
+
+/* Inflate up to @len bytes at the current position into @dest, or drop them
+ * if @dest is NULL. Checkpoints are added to the index on the way */
+static GstFlowReturn
+pull_inflate (GstGzdec * gzdec, guint8 * dest, gsize len, gsize * produced)
+{
+  z_stream *strm = &gzdec->pull_zstrm;
+  GstFlowReturn ret;
+  gsize n;
+  int err;
+
+  *produced = 0;
+  while (*produced < len && !gzdec->pull_done) {
+    if (strm->avail_in == 0) {
+      ret = pull_input (gzdec);
+      if (ret == GST_FLOW_EOS) {
+        if (gzdec->pull_raw || gzdec->pull_skip > 0 || strm->total_in > 0) {
+          GST_WARNING_OBJECT (gzdec, "Truncated gzip stream");
+          gzdec->pull_done = TRUE;
+        } else {
+          pull_end (gzdec);
+        }
+        break;
+      }
+      if (ret != GST_FLOW_OK)
+        return ret;
+    }
+
+    if (gzdec->pull_skip > 0) {
+      n = MIN (gzdec->pull_skip, strm->avail_in);
+      strm->next_in += n;
+      strm->avail_in -= n;
+      gzdec->pull_skip -= n;
+      continue;
+    }
+
+    if (dest) {
+      strm->next_out = dest + *produced;
+      strm->avail_out = len - *produced;
+    } else {
+      strm->next_out = gzdec->pull_scratch;
+      strm->avail_out = MIN (len - *produced, PULL_SCRATCH_SIZE);
+    }
+    n = strm->avail_out;
+    err = inflate (strm, Z_BLOCK);
+    n -= strm->avail_out;
+    *produced += n;
+    GST_OBJECT_LOCK (gzdec);
+    gzdec->pull_out += n;
+    GST_OBJECT_UNLOCK (gzdec);
+
+    if (err == Z_STREAM_END) {
+      // Raw decoding from a checkpoint leaves the gzip trailer to us
+      if (gzdec->pull_raw)
+        gzdec->pull_skip = 8;
+      gzdec->pull_raw = FALSE;
+      inflateReset2 (strm, MAX_WBITS + 16);
+      if (!(gzdec->index->flags & GST_GZDEC_INDEX_MULTI_MEMBER))
+        pull_end (gzdec);
+      continue;
+    }
+
+    if (err != Z_OK && err != Z_BUF_ERROR) {
+      if (!gzdec->pull_raw && gzdec->pull_out > 0 && strm->total_out == 0) {
+        GST_WARNING_OBJECT (gzdec, "Trailing garbage ignored");
+        pull_end (gzdec);
+        break;
+      }
+      GST_ELEMENT_ERROR (gzdec, STREAM, DECODE, (NULL),
+          ("Inflate error: %s", strm->msg ? strm->msg : zError (err)));
+      return GST_FLOW_ERROR;
+    }
+
+    // At a block boundary, not the end of the last one
+    if ((strm->data_type & 128) && !(strm->data_type & 64)
+        && gzdec->pull_out >= gst_gzdec_index_last_offset (gzdec->index) +
+        gzdec->pull_interval)
+      gst_gzdec_index_add (gzdec->index, strm,
+          gzdec->pull_in - strm->avail_in, gzdec->pull_out);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_gzdec_get_range (GstPad * pad, GstObject * parent, guint64 offset,
+    guint length, GstBuffer ** buffer)
+{
+  GstGzdec *gzdec = GST_GZDEC (parent);
+  const GstGzdecCheckpoint *point;
+  GstFlowReturn ret;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gsize produced;
+
+  GST_LOG_OBJECT (gzdec, "getrange %u bytes at %" G_GUINT64_FORMAT, length,
+      offset);
+
+  if (gzdec->index->complete && offset >= gzdec->index->total_out)
+    return GST_FLOW_EOS;
+
+  // Jump to the nearest checkpoint when going back or far enough ahead
+  point = gst_gzdec_index_lookup (gzdec->index, offset);
+  if (offset < gzdec->pull_out || (point && point->out > gzdec->pull_out)) {
+    ret = pull_seek (gzdec, point);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  if (gzdec->pull_out < offset) {
+    ret = pull_inflate (gzdec, NULL, offset - gzdec->pull_out, &produced);
+    if (ret != GST_FLOW_OK)
+      return ret;
+    if (gzdec->pull_out < offset)
+      return GST_FLOW_EOS;
+  }
+
+  buf = *buffer ? *buffer : gst_buffer_new_allocate (NULL, length, NULL);
+  if (!gst_buffer_map (buf, &map, GST_MAP_WRITE)) {
+    ret = GST_FLOW_ERROR;
+    goto free_buf;
+  }
+  ret = pull_inflate (gzdec, map.data, MIN (length, map.size), &produced);
+  gst_buffer_unmap (buf, &map);
+  if (ret != GST_FLOW_OK)
+    goto free_buf;
+  if (produced == 0) {
+    ret = GST_FLOW_EOS;
+    goto free_buf;
+  }
+
+  gst_buffer_set_size (buf, produced);
+  GST_BUFFER_OFFSET (buf) = offset;
+  GST_BUFFER_OFFSET_END (buf) = offset + produced;
+  *buffer = buf;
+  return GST_FLOW_OK;
+
+free_buf:
+  if (buf != *buffer)
+    gst_buffer_unref (buf);
+  return ret;
+}
+
+/* Library and version of the backend decoding @format */
+static gchar *
+engine_description (GstGzdecFormat format, gboolean libdeflate)
+{
+#ifdef HAVE_LZ4
+  unsigned version;
+#endif
+
+  switch (format) {
+    case GST_GZDEC_FORMAT_BZIP2:
+      return g_strdup_printf ("bzip2 %s", BZ2_bzlibVersion ());
+#ifdef HAVE_ZSTD
+    case GST_GZDEC_FORMAT_ZSTD:
+      return g_strdup_printf ("zstd %s", ZSTD_versionString ());
+#endif
+#ifdef HAVE_LZMA
+    case GST_GZDEC_FORMAT_XZ:
+      return g_strdup_printf ("xz %s", lzma_version_string ());
+#endif
+#ifdef HAVE_LZ4
+    case GST_GZDEC_FORMAT_LZ4:
+      version = LZ4F_getVersion ();
+      return g_strdup_printf ("lz4 %u.%u.%u", version / 10000,
+          version / 100 % 100, version % 100);
+#endif
+    default:
+      break;
+  }
+
+#ifdef HAVE_LIBDEFLATE
+  if (libdeflate)
+    return g_strdup ("libdeflate " LIBDEFLATE_VERSION_STRING);
+#endif
+#ifdef HAVE_ZLIB_NG
+  return g_strdup_printf ("zlib-ng %s", zlibng_version ());
+#else
+  return g_strdup_printf ("zlib %s", zlibVersion ());
+#endif
+}
+
+static void
+set_zlib_backend (GstGzdec * gzdec, gboolean zero_copy)
+{
+  gzdec->xz_prepare_in_buffer  = zlib_prepare_in_buffer;
+  gzdec->xz_prepare_out_buffer = zlib_prepare_out_buffer;
+  gzdec->xz_uncompress_step    = zero_copy ? zlib_zc_uncompress_step :
+      zlib_uncompress_step;
+  gzdec->xz_out_buffer_size    = zlib_out_buffer_size;
+  gzdec->xz_in_buffer_left     = zlib_in_buffer_left;
+  gzdec->xz_reset              = zlib_reset;
+  gzdec->xz_drain              = NULL;
+  gzdec->xz_free               = zlib_free;
+}
+
+static gboolean
+xzlib_init (GstGzdec * gzdec, GstGzdecFormat format)
+{
+  gboolean parallel, zero_copy, libdeflate, whole_member;
+  gchar *engine;
+  int ret;
+
+  // libdeflate replaces zlib for all the deflate based formats
+  GST_OBJECT_LOCK (gzdec);
+  libdeflate = gzdec->engine == GST_GZDEC_ENGINE_LIBDEFLATE
+      && (format == GST_GZDEC_FORMAT_GZIP || format == GST_GZDEC_FORMAT_ZLIB
+      || format == GST_GZDEC_FORMAT_DEFLATE);
+  GST_OBJECT_UNLOCK (gzdec);
+#ifndef HAVE_LIBDEFLATE
+  if (libdeflate) {
+    GST_WARNING_OBJECT (gzdec, "Built without libdeflate, using zlib");
+    libdeflate = FALSE;
+  }
+#endif
+
+  // Only multi-member gzip streams can be split. Stored blocks are passed
+  // through checking the gzip trailer
+  GST_OBJECT_LOCK (gzdec);
+  parallel = !libdeflate && gzdec->threads != 1
+      && (format == GST_GZDEC_FORMAT_BZIP2
+      || (format == GST_GZDEC_FORMAT_GZIP && gzdec->multi_member));
+  zero_copy = gzdec->zero_copy_stored && format == GST_GZDEC_FORMAT_GZIP;
+  whole_member = gzdec->engine == GST_GZDEC_ENGINE_AUTO && !zero_copy
+      && format == GST_GZDEC_FORMAT_GZIP;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  gzdec->stream_format = format;
+  gzdec->whole_member = FALSE;
+
+  // Not set by the backends holding input back, or taking it all at once
+  gzdec->xz_drain = NULL;
+  gzdec->xz_in_buffer_left = NULL;
+  if (parallel) {
+    gzdec->xz_prepare_in_buffer  = parallel_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = parallel_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = parallel_uncompress_step;
+    gzdec->xz_out_buffer_size    = parallel_out_buffer_size;
+    gzdec->xz_reset              = parallel_reset;
+    gzdec->xz_drain              = parallel_drain;
+    gzdec->xz_free               = parallel_free;
+
+    ret = parallel_init (gzdec, format == GST_GZDEC_FORMAT_BZIP2 ?
+        GST_GZDEC_PARALLEL_BZIP2 : GST_GZDEC_PARALLEL_GZIP);
+  } else if (format == GST_GZDEC_FORMAT_BZIP2) {
+    gzdec->xz_prepare_in_buffer  = bzlib_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = bzlib_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = bzlib_uncompress_step;
+    gzdec->xz_out_buffer_size    = bzlib_out_buffer_size;
+    gzdec->xz_in_buffer_left     = bzlib_in_buffer_left;
+    gzdec->xz_reset              = bzlib_reset;
+    gzdec->xz_free               = bzlib_free;
+
+    ret = bzlib_init (gzdec);
+  } else if (format == GST_GZDEC_FORMAT_ZSTD) {
+#ifdef HAVE_ZSTD
+    gzdec->xz_prepare_in_buffer  = zstd_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = zstd_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = zstd_uncompress_step;
+    gzdec->xz_out_buffer_size    = zstd_out_buffer_size;
+    gzdec->xz_in_buffer_left     = zstd_in_buffer_left;
+    gzdec->xz_reset              = zstd_reset;
+    gzdec->xz_free               = zstd_free;
+
+    ret = zstd_init (gzdec);
+#else
+    GST_ERROR_OBJECT (gzdec, "Built without zstd support");
+    ret = -1;
+#endif
+  } else if (format == GST_GZDEC_FORMAT_XZ) {
+#ifdef HAVE_LZMA
+    gzdec->xz_prepare_in_buffer  = liblzma_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = liblzma_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = liblzma_uncompress_step;
+    gzdec->xz_out_buffer_size    = liblzma_out_buffer_size;
+    gzdec->xz_in_buffer_left     = liblzma_in_buffer_left;
+    gzdec->xz_reset              = liblzma_reset;
+    gzdec->xz_drain              = liblzma_drain;
+    gzdec->xz_free               = liblzma_free;
+
+    ret = liblzma_init (gzdec);
+#else
+    GST_ERROR_OBJECT (gzdec, "Built without xz support");
+    ret = -1;
+#endif
+  } else if (format == GST_GZDEC_FORMAT_LZ4) {
+#ifdef HAVE_LZ4
+    gzdec->xz_prepare_in_buffer  = lz4_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = lz4_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = lz4_uncompress_step;
+    gzdec->xz_out_buffer_size    = lz4_out_buffer_size;
+    gzdec->xz_in_buffer_left     = lz4_in_buffer_left;
+    gzdec->xz_reset              = lz4_reset;
+    gzdec->xz_drain              = lz4_drain;
+    gzdec->xz_free               = lz4_free;
+
+    ret = lz4_init (gzdec);
+#else
+    GST_ERROR_OBJECT (gzdec, "Built without LZ4 support");
+    ret = -1;
+#endif
+  } else if (libdeflate) {
+#ifdef HAVE_LIBDEFLATE
+    gzdec->xz_prepare_in_buffer  = libdeflate_prepare_in_buffer;
+    gzdec->xz_prepare_out_buffer = libdeflate_prepare_out_buffer;
+    gzdec->xz_uncompress_step    = libdeflate_uncompress_step;
+    gzdec->xz_out_buffer_size    = libdeflate_out_buffer_size;
+    gzdec->xz_reset              = libdeflate_reset;
+    gzdec->xz_drain              = libdeflate_drain;
+    gzdec->xz_free               = libdeflate_free;
+
+    ret = libdeflate_init (gzdec);
+#endif
+  } else {
+    set_zlib_backend (gzdec, zero_copy);
+    gzdec->whole_member = whole_member;
+
+    ret = zlib_init (gzdec);
+  }
+  if (ret != 0)
+    return FALSE;
+
+  engine = engine_description (format, libdeflate);
+  GST_INFO_OBJECT (gzdec, "Decoding with %s", engine);
+  GST_OBJECT_LOCK (gzdec);
+  g_free (gzdec->active_engine);
+  gzdec->active_engine = engine;
+  // Only streaming inflate goes on from a checkpoint of a gzip index
+  gzdec->raw_restart = format == GST_GZDEC_FORMAT_GZIP && !parallel
+      && !libdeflate && !zero_copy;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  gzdec->members = 0;
+  gzdec->member_out = 0;
+  GST_OBJECT_LOCK (gzdec);
+  gzdec->total_out = 0;
+  gzdec->duration = 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  reset_timestamps (gzdec);
+  gzdec->xz_initialized = TRUE;
+  return TRUE;
+}
+
+/* inflate window bits selecting the wrapper of the stream format */
+static int
+zlib_window_bits (GstGzdec * gzdec)
+{
+  switch (gzdec->stream_format) {
+    case GST_GZDEC_FORMAT_ZLIB:
+      return MAX_WBITS;
+    case GST_GZDEC_FORMAT_DEFLATE:
+      return -MAX_WBITS;
+    default:
+      return MAX_WBITS + 16;
+  }
+}
+
+static int
+zlib_init (GstGzdec * gzdec)
+{
+  gboolean arena;
+
+  GST_DEBUG_OBJECT (gzdec, "zlib init");
+  gzdec->zc_raw = FALSE;
+  gzdec->zc_stored = FALSE;
+  gzdec->zc_trailer = FALSE;
+  gzdec->zc_resume = FALSE;
+  gzdec->zlib_raw = FALSE;
+  gzdec->zlib_skip = 0;
+
+  GST_OBJECT_LOCK (gzdec);
+  arena = gzdec->arena_size > 0;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  gzdec->zstrm = gst_gzdec_pool_acquire (zlib_window_bits (gzdec),
+      arena ? &gzdec->arena_usage : NULL);
+  return gzdec->zstrm ? Z_OK : Z_MEM_ERROR;
+}
+
+static void
+zlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->zstrm->next_in  = buf;
+  gzdec->zstrm->avail_in = len;
+  gzdec->in_start = buf;
+}
+
+static void
+zlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->zstrm->next_out  = buf;
+  gzdec->zstrm->avail_out = len;
+}
+
+static size_t
+zlib_out_buffer_size (GstGzdec * gzdec)
+{
+  return gzdec->out_buf_capacity - gzdec->zstrm->avail_out;
+}
+
+static size_t
+zlib_in_buffer_left (GstGzdec * gzdec)
+{
+  return gzdec->zstrm->avail_in;
+}
+
+/* Go on raw from the checkpoint of a seek. The input starts at the byte
+ * before it when the checkpoint is in the middle of one */
+static int
+zlib_seek_restart (GstGzdec * gzdec)
+{
+  const GstGzdecCheckpoint *point = gzdec->seek_restart;
+  z_stream *strm = gzdec->zstrm;
+  guint8 prev_byte = 0;
+
+  if (point->bits) {
+    if (strm->avail_in == 0)
+      return XZ_MORE_INPUT;
+    prev_byte = *strm->next_in++;
+    strm->avail_in--;
+  }
+
+  GST_DEBUG_OBJECT (gzdec, "Restart from checkpoint at %" G_GUINT64_FORMAT,
+      point->out);
+  gzdec->seek_restart = NULL;
+  gzdec->zlib_raw = TRUE;
+  if (gst_gzdec_index_restore (point, strm, prev_byte) != Z_OK)
+    return XZ_ERROR;
+
+  return 0;
+}
+
+static int
+zlib_uncompress_step (GstGzdec * gzdec)
+{
+  z_stream *strm = gzdec->zstrm;
+  Bytef *out;
+  uInt avail;
+  gsize len;
+  int ret;
+  int err;
+
+  ret = 0;
+
+  if (gzdec->seek_restart) {
+    ret = zlib_seek_restart (gzdec);
+    if (ret != 0)
+      return ret;
+  }
+
+  // The trailer of a member restarted raw isn't read by inflate
+  if (gzdec->zlib_skip > 0) {
+    len = MIN (gzdec->zlib_skip, strm->avail_in);
+    strm->next_in += len;
+    strm->avail_in -= len;
+    gzdec->zlib_skip -= len;
+    if (gzdec->zlib_skip == 0)
+      ret |= XZ_FINISH;
+    if (strm->avail_in == 0)
+      ret |= XZ_MORE_INPUT;
+    return ret;
+  }
+
+  // Output before the position sought is overwritten by the next one
+  out = strm->next_out;
+  avail = strm->avail_out;
+  if (gzdec->seek_discard > 0 && gzdec->seek_discard < avail)
+    strm->avail_out = gzdec->seek_discard;
+
+  err = inflate (strm, Z_SYNC_FLUSH);
+  if ((err < 0) && (err != Z_BUF_ERROR)) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%s\"\n", zError (err));
+    if (strm->msg)
+      GST_DEBUG_OBJECT (gzdec, "%s\n", strm->msg);
+    return XZ_ERROR;
+  }
+
+  if (gzdec->seek_discard > 0) {
+    gzdec->seek_discard -= strm->next_out - out;
+    strm->next_out = out;
+    strm->avail_out = avail;
+  }
+
+  if (err == Z_STREAM_END) {
+    if (gzdec->zlib_raw) {
+      gzdec->zlib_raw = FALSE;
+      gzdec->zlib_skip = 8;
+    } else {
+      ret |= XZ_FINISH;
+    }
+  }
+  if (strm->avail_out == 0)
+    ret |= XZ_MORE_OUTPUT;
+  if (strm->avail_in == 0)
+    ret |= XZ_MORE_INPUT;
+
+  return ret;
+}
+
+/* At a block boundary, take over the next block if it is a stored one with
+ * its header in the current input buffer */
+static gboolean
+zlib_zc_stored_start (GstGzdec * gzdec, guint pending)
+{
+  z_stream *strm = gzdec->zstrm;
+  const guint8 *p = strm->next_in;
+  gsize avail = strm->avail_in;
+  guint bits, len;
+
+  // The bits held by zlib are the top of the last byte it took
+  if (pending > 0 && p == gzdec->in_start)
+    return FALSE;
+  bits = pending > 0 ? p[-1] >> (8 - pending) : 0;
+  if (pending < 3) {
+    if (avail == 0)
+      return FALSE;
+    bits |= *p++ << pending;
+    avail--;
+  }
+
+  // BTYPE 00, then LEN and NLEN from the next byte boundary
+  if ((bits & 6) != 0 || avail < 4)
+    return FALSE;
+  len = p[0] | p[1] << 8;
+  if (len != (~(p[2] | p[3] << 8) & 0xffff))
+    return FALSE;
+
+  // From here on the wrapper of this member is checked by us
+  if (!gzdec->zc_raw) {
+    gzdec->zc_crc = strm->adler;
+    gzdec->zc_size = strm->total_out;
+    gzdec->zc_raw = TRUE;
+  }
+  if (!gzdec->zc_window)
+    gzdec->zc_window = g_malloc (ZC_WINDOW_SIZE);
+  gzdec->zc_window_len = ZC_WINDOW_SIZE;
+  inflateGetDictionary (strm, gzdec->zc_window, &gzdec->zc_window_len);
+
+  strm->next_in = (Bytef *) p + 4;
+  strm->avail_in = avail - 4;
+  gzdec->zc_stored = TRUE;
+  gzdec->zc_final = bits & 1;
+  gzdec->zc_stored_left = len;
+  return TRUE;
+}
+
+/* Account stored data in the member CRC, size and deflate window */
+static void
+zlib_zc_consume (GstGzdec * gzdec, const guint8 * data, gsize len)
+{
+  guint keep;
+
+  gzdec->zc_crc = crc32 (gzdec->zc_crc, data, len);
+  gzdec->zc_size += len;
+
+  if (len >= ZC_WINDOW_SIZE) {
+    memcpy (gzdec->zc_window, data + len - ZC_WINDOW_SIZE, ZC_WINDOW_SIZE);
+    gzdec->zc_window_len = ZC_WINDOW_SIZE;
+    return;
+  }
+  keep = MIN (gzdec->zc_window_len, ZC_WINDOW_SIZE - len);
+  memmove (gzdec->zc_window,
+      gzdec->zc_window + gzdec->zc_window_len - keep, keep);
+  memcpy (gzdec->zc_window + keep, data, len);
+  gzdec->zc_window_len = keep + len;
+}
+
+/* Resume inflating raw after a stored block, or read the trailer if it was
+ * the last block of the member */
+static gboolean
+zlib_zc_stored_end (GstGzdec * gzdec)
+{
+  gzdec->zc_stored = FALSE;
+  if (gzdec->zc_final) {
+    gzdec->zc_trailer = TRUE;
+    gzdec->zc_trailer_len = 0;
+    return TRUE;
+  }
+
+  // The stored data must stay visible to the following blocks. A raw stream
+  // doesn't stop before its first block header, so look at it ourselves
+  gzdec->zc_resume = TRUE;
+  return inflateReset2 (gzdec->zstrm, -MAX_WBITS) == Z_OK
+      && inflateSetDictionary (gzdec->zstrm, gzdec->zc_window,
+      gzdec->zc_window_len) == Z_OK;
+}
+
+/* Like zlib_uncompress_step, but inflating a block at a time so the stored
+ * blocks can be handed to the chain as regions of the input buffer */
+static int
+zlib_zc_uncompress_step (GstGzdec * gzdec)
+{
+  z_stream *strm = gzdec->zstrm;
+  guint8 *out;
+  gsize len;
+  int ret;
+  int err;
+
+  ret = 0;
+
+  if (gzdec->zc_stored) {
+    len = MIN (gzdec->zc_stored_left, strm->avail_in);
+    if (len > 0) {
+      gzdec->pt_offset = strm->next_in - gzdec->in_start;
+      gzdec->pt_len = len;
+      zlib_zc_consume (gzdec, strm->next_in, len);
+      strm->next_in += len;
+      strm->avail_in -= len;
+      gzdec->zc_stored_left -= len;
+      ret |= XZ_PASSTHROUGH;
+    }
+    if (gzdec->zc_stored_left == 0 && !zlib_zc_stored_end (gzdec))
+      return XZ_ERROR;
+  } else if (gzdec->zc_trailer) {
+    len = MIN (8 - gzdec->zc_trailer_len, strm->avail_in);
+    memcpy (gzdec->zc_trailer_buf + gzdec->zc_trailer_len, strm->next_in, len);
+    strm->next_in += len;
+    strm->avail_in -= len;
+    gzdec->zc_trailer_len += len;
+    if (gzdec->zc_trailer_len == 8) {
+      if (GST_READ_UINT32_LE (gzdec->zc_trailer_buf) != gzdec->zc_crc
+          || GST_READ_UINT32_LE (gzdec->zc_trailer_buf + 4) !=
+          (guint32) gzdec->zc_size) {
+        GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"incorrect trailer\"");
+        return XZ_ERROR;
+      }
+      gzdec->zc_trailer = FALSE;
+      ret |= XZ_FINISH;
+    }
+  } else if (gzdec->zc_resume && zlib_zc_stored_start (gzdec, 0)) {
+    GST_LOG_OBJECT (gzdec, "Stored block of %" G_GSIZE_FORMAT " bytes",
+        gzdec->zc_stored_left);
+  } else {
+    // Wait for the next input if the header may be in it
+    if (strm->avail_in > 0)
+      gzdec->zc_resume = FALSE;
+
+    out = strm->next_out;
+    err = inflate (strm, Z_BLOCK);
+    if ((err < 0) && (err != Z_BUF_ERROR)) {
+      GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%s\"\n", zError (err));
+      if (strm->msg)
+        GST_DEBUG_OBJECT (gzdec, "%s\n", strm->msg);
+      return XZ_ERROR;
+    }
+
+    if (gzdec->zc_raw) {
+      gzdec->zc_crc = crc32 (gzdec->zc_crc, out, strm->next_out - out);
+      gzdec->zc_size += strm->next_out - out;
+    }
+
+    if (err == Z_STREAM_END) {
+      if (gzdec->zc_raw) {
+        gzdec->zc_trailer = TRUE;
+        gzdec->zc_trailer_len = 0;
+      } else {
+        ret |= XZ_FINISH;
+      }
+    } else if ((strm->data_type & 128)
+        && zlib_zc_stored_start (gzdec, strm->data_type & 7)) {
+      GST_LOG_OBJECT (gzdec, "Stored block of %" G_GSIZE_FORMAT " bytes",
+          gzdec->zc_stored_left);
+    }
+  }
+
+  if (strm->avail_out == 0)
+    ret |= XZ_MORE_OUTPUT;
+  if (strm->avail_in == 0)
+    ret |= XZ_MORE_INPUT;
+
+  return ret;
+}
+
+static int
+zlib_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "zlib reset");
+  gzdec->zc_raw = FALSE;
+  gzdec->zc_stored = FALSE;
+  gzdec->zc_trailer = FALSE;
+  gzdec->zc_resume = FALSE;
+  gzdec->zlib_raw = FALSE;
+  gzdec->zlib_skip = 0;
+
+  // The zero-copy or a seek may have left the stream raw
+  return inflateReset2 (gzdec->zstrm, zlib_window_bits (gzdec));
+}
+
+static void
+zlib_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "zlib free");
+  gst_gzdec_pool_release (gzdec->zstrm);
+  gzdec->zstrm = NULL;
+  g_free (gzdec->zc_window);
+  gzdec->zc_window = NULL;
+#ifdef HAVE_LIBDEFLATE
+  g_clear_pointer (&gzdec->whole_dec, libdeflate_free_decompressor);
+  g_clear_pointer (&gzdec->ld_backlog, g_byte_array_unref);
+#endif
+}
+
+static int
+bzlib_init (GstGzdec * gzdec)
+{
+  gboolean arena;
+
+  GST_DEBUG_OBJECT (gzdec, "bzlib init");
+  gzdec->bzstrm.next_in   = NULL;
+  gzdec->bzstrm.avail_in  = 0;
+  gzdec->bzstrm.next_out  = NULL;
+  gzdec->bzstrm.avail_out = 0;
+
+  GST_OBJECT_LOCK (gzdec);
+  arena = gzdec->arena_size > 0;
+  GST_OBJECT_UNLOCK (gzdec);
+  if (arena) {
+    gzdec->bzstrm.bzalloc = gst_gzdec_arena_bzalloc;
+    gzdec->bzstrm.bzfree  = gst_gzdec_arena_bzfree;
+    gzdec->bzstrm.opaque  = &gzdec->arena_usage;
+  } else {
+    gzdec->bzstrm.bzalloc = NULL;
+    gzdec->bzstrm.bzfree  = NULL;
+    gzdec->bzstrm.opaque  = NULL;
+  }
+
+  return BZ2_bzDecompressInit (&gzdec->bzstrm, 0, 0);
+}
+
+static void
+bzlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->bzstrm.next_in  = buf;
+  gzdec->bzstrm.avail_in = len;
+}
+
+static void
+bzlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->bzstrm.next_out  = buf;
+  gzdec->bzstrm.avail_out = len;
+}
+
+static size_t
+bzlib_out_buffer_size (GstGzdec * gzdec)
+{
+  return gzdec->out_buf_capacity - gzdec->bzstrm.avail_out;
+}
+
+static size_t
+bzlib_in_buffer_left (GstGzdec * gzdec)
+{
+  return gzdec->bzstrm.avail_in;
+}
+
+static int
+bzlib_uncompress_step (GstGzdec * gzdec)
+{
+  int ret = 0;
+  int err;
+
+  err = BZ2_bzDecompress (&gzdec->bzstrm);
+  if ((err != BZ_OK) && (err != BZ_STREAM_END)) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%d\"\n", err);
+    return XZ_ERROR;
+  }
+
+  if (err == BZ_STREAM_END)
+    ret |= XZ_FINISH;
+  if (gzdec->bzstrm.avail_out == 0)
+    ret |= XZ_MORE_OUTPUT;
+  if (gzdec->bzstrm.avail_in == 0)
+    ret |= XZ_MORE_INPUT;
+
+  return ret;
+}
+
+static int
+bzlib_reset (GstGzdec * gzdec)
+{
+  bz_stream *strm = &gzdec->bzstrm;
+  char *next_in = strm->next_in;
+  unsigned int avail_in = strm->avail_in;
+  char *next_out = strm->next_out;
+  unsigned int avail_out = strm->avail_out;
+  int err;
+
+  /* bzlib has no reset, so the stream must be recreated. The buffers being
+   * decoded are kept */
+  GST_DEBUG_OBJECT (gzdec, "bzlib reset");
+  BZ2_bzDecompressEnd (strm);
+  err = BZ2_bzDecompressInit (strm, 0, 0);
+
+  strm->next_in = next_in;
+  strm->avail_in = avail_in;
+  strm->next_out = next_out;
+  strm->avail_out = avail_out;
+
+  return err;
+}
+
+static void
+bzlib_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "bzlib free");
+  BZ2_bzDecompressEnd (&gzdec->bzstrm);
+}
+
+#ifdef HAVE_ZSTD
+static int
+zstd_init (GstGzdec * gzdec)
+{
+  ZSTD_DCtx *dctx;
+  gchar *location;
+  guint window_log_max;
+  gchar *dict;
+  gsize dict_len;
+  GError *err = NULL;
+  size_t ret;
+
+  GST_OBJECT_LOCK (gzdec);
+  window_log_max = gzdec->window_log_max;
+  location = g_strdup (gzdec->dictionary_location);
+  GST_OBJECT_UNLOCK (gzdec);
+
+  GST_DEBUG_OBJECT (gzdec, "zstd init");
+  dctx = ZSTD_createDCtx ();
+  if (!dctx)
+    goto error;
+  gzdec->zstdstrm.dctx = dctx;
+  gzdec->zstdstrm.in.src   = NULL;
+  gzdec->zstdstrm.in.size  = 0;
+  gzdec->zstdstrm.in.pos   = 0;
+  gzdec->zstdstrm.out.dst  = NULL;
+  gzdec->zstdstrm.out.size = 0;
+  gzdec->zstdstrm.out.pos  = 0;
+
+  if (window_log_max > 0) {
+    ret = ZSTD_DCtx_setParameter (dctx, ZSTD_d_windowLogMax, window_log_max);
+    if (ZSTD_isError (ret)) {
+      GST_WARNING_OBJECT (gzdec, "Can't set the window log max: %s",
+          ZSTD_getErrorName (ret));
+      goto error;
+    }
+  }
+
+  // The dictionary is copied by zstd
+  if (location) {
+    if (!g_file_get_contents (location, &dict, &dict_len, &err)) {
+      GST_WARNING_OBJECT (gzdec, "Can't read the dictionary: %s",
+          err->message);
+      g_error_free (err);
+      goto error;
+    }
+    ret = ZSTD_DCtx_loadDictionary (dctx, dict, dict_len);
+    g_free (dict);
+    if (ZSTD_isError (ret)) {
+      GST_WARNING_OBJECT (gzdec, "Can't load the dictionary: %s",
+          ZSTD_getErrorName (ret));
+      goto error;
+    }
+  }
+
+  g_free (location);
+  return 0;
+
+error:
+  ZSTD_freeDCtx (dctx);
+  g_free (location);
+  return -1;
+}
+
+static void
+zstd_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->zstdstrm.in.src  = buf;
+  gzdec->zstdstrm.in.size = len;
+  gzdec->zstdstrm.in.pos  = 0;
+}
+
+static void
+zstd_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->zstdstrm.out.dst  = buf;
+  gzdec->zstdstrm.out.size = len;
+  gzdec->zstdstrm.out.pos  = 0;
+}
+
+static size_t
+zstd_out_buffer_size (GstGzdec * gzdec)
+{
+  return gzdec->zstdstrm.out.pos;
+}
+
+static size_t
+zstd_in_buffer_left (GstGzdec * gzdec)
+{
+  return gzdec->zstdstrm.in.size - gzdec->zstdstrm.in.pos;
+}
+
+static int
+zstd_uncompress_step (GstGzdec * gzdec)
+{
+  ZSTD_inBuffer *in = &gzdec->zstdstrm.in;
+  ZSTD_outBuffer *out = &gzdec->zstdstrm.out;
+  size_t err;
   int ret;
-  int err;
 
   ret = 0;
 
-  err = inflate (&gzdec->zstrm, Z_SYNC_FLUSH);
-  if ((err < 0) && (err != Z_BUF_ERROR)) {
-    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%s\"\n", zError (err));
-    if (gzdec->zstrm.msg)
-      GST_DEBUG_OBJECT (gzdec, "%s\n", gzdec->zstrm.msg);
+  err = ZSTD_decompressStream (gzdec->zstdstrm.dctx, out, in);
+  if (ZSTD_isError (err)) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%s\"",
+        ZSTD_getErrorName (err));
     return XZ_ERROR;
   }
 
-  if (err == Z_STREAM_END) {
+  // A full output buffer may leave decoded data inside zstd
+  if (err == 0)
     ret |= XZ_FINISH;
-    if (gzdec->zstrm.avail_out > 0)
-      ret |= XZ_MORE_OUTPUT;
+  if (out->pos == out->size)
+    ret |= XZ_MORE_OUTPUT;
+  else if (in->pos == in->size)
+    ret |= XZ_MORE_INPUT;
+
+  return ret;
+}
+
+static int
+zstd_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "zstd reset");
+  return ZSTD_isError (ZSTD_DCtx_reset (gzdec->zstdstrm.dctx,
+          ZSTD_reset_session_only)) ? -1 : 0;
+}
+
+static void
+zstd_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "zstd free");
+  ZSTD_freeDCtx (gzdec->zstdstrm.dctx);
+}
+#endif
+
+#ifdef HAVE_LZMA
+/* Start decoding .xz input, with the block decoding threads if liblzma has
+ * them. In multi-member mode liblzma decodes the concatenated streams and
+ * the stream padding between them itself, and only ends once drained */
+static int
+liblzma_start (GstGzdec * gzdec)
+{
+  lzma_stream *strm = &gzdec->lzstrm.strm;
+  guint64 memory_limit;
+  guint threads;
+  guint32 flags;
+  lzma_ret err;
+
+  GST_OBJECT_LOCK (gzdec);
+  threads = gzdec->threads;
+  memory_limit = gzdec->memory_limit;
+  flags = gzdec->multi_member ? LZMA_CONCATENATED : 0;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  if (memory_limit == 0)
+    memory_limit = G_MAXUINT64;
+
+#if LZMA_VERSION >= 50040002
+  if (threads != 1) {
+    lzma_mt mt;
+
+    // Past the threading limit blocks are decoded in a single thread,
+    // past the stop limit decoding fails
+    memset (&mt, 0, sizeof (mt));
+    mt.threads = threads > 0 ? threads : MAX (lzma_cputhreads (), 1);
+    mt.memlimit_threading = memory_limit;
+    mt.memlimit_stop = memory_limit;
+    mt.flags = flags;
+    GST_DEBUG_OBJECT (gzdec, "liblzma start, %u threads", mt.threads);
+    err = lzma_stream_decoder_mt (strm, &mt);
+  } else
+#endif
+  {
+    GST_DEBUG_OBJECT (gzdec, "liblzma start");
+    err = lzma_stream_decoder (strm, memory_limit, flags);
+  }
+
+  gzdec->lzstrm.started = FALSE;
+  gzdec->lzstrm.finish = FALSE;
+  return err == LZMA_OK ? 0 : -1;
+}
+
+static int
+liblzma_init (GstGzdec * gzdec)
+{
+  lzma_stream init = LZMA_STREAM_INIT;
+
+  GST_DEBUG_OBJECT (gzdec, "liblzma init");
+  gzdec->lzstrm.strm = init;
+
+  return liblzma_start (gzdec);
+}
+
+static void
+liblzma_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->lzstrm.strm.next_in  = buf;
+  gzdec->lzstrm.strm.avail_in = len;
+  if (len > 0)
+    gzdec->lzstrm.started = TRUE;
+}
+
+static void
+liblzma_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->lzstrm.strm.next_out  = buf;
+  gzdec->lzstrm.strm.avail_out = len;
+}
+
+static size_t
+liblzma_out_buffer_size (GstGzdec * gzdec)
+{
+  return gzdec->out_buf_capacity - gzdec->lzstrm.strm.avail_out;
+}
+
+static size_t
+liblzma_in_buffer_left (GstGzdec * gzdec)
+{
+  return gzdec->lzstrm.strm.avail_in;
+}
+
+static int
+liblzma_uncompress_step (GstGzdec * gzdec)
+{
+  lzma_stream *strm = &gzdec->lzstrm.strm;
+  gboolean finish = gzdec->lzstrm.finish;
+  lzma_ret err;
+  int ret;
+
+  ret = 0;
+
+  // Draining without any input
+  if (finish && !gzdec->lzstrm.started)
+    return XZ_END;
+
+  err = lzma_code (strm, finish ? LZMA_FINISH : LZMA_RUN);
+  if (err == LZMA_MEMLIMIT_ERROR) {
+    GST_WARNING_OBJECT (gzdec, "Uncompress error: \"memory limit of %"
+        G_GUINT64_FORMAT " bytes reached, %" G_GUINT64_FORMAT " needed\"",
+        lzma_memlimit_get (strm), lzma_memusage (strm));
+    return XZ_ERROR;
+  }
+  if (err != LZMA_OK && err != LZMA_STREAM_END
+      && (err != LZMA_BUF_ERROR || finish)) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: %d", err);
+    return XZ_ERROR;
   }
-  if (gzdec->zstrm.avail_out == 0)
+
+  // Before draining, only the end of a single stream
+  if (err == LZMA_STREAM_END)
+    ret |= finish ? XZ_END : XZ_FINISH;
+
+  // The decoding threads may still hold data when the output is full
+  if (strm->avail_out == 0)
     ret |= XZ_MORE_OUTPUT;
-  if (gzdec->zstrm.avail_in == 0)
+  else if (strm->avail_in == 0 && !finish)
     ret |= XZ_MORE_INPUT;
 
   return ret;
 }
 
+static int
+liblzma_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "liblzma reset");
+  return liblzma_start (gzdec);
+}
+
 static void
-zlib_free (GstGzdec * gzdec)
+liblzma_drain (GstGzdec * gzdec)
 {
-  GST_DEBUG_OBJECT (gzdec, "zlib free");
-  inflateEnd (&gzdec->zstrm);
+  GST_DEBUG_OBJECT (gzdec, "liblzma drain");
+  gzdec->lzstrm.finish = TRUE;
+}
+
+static void
+liblzma_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "liblzma free");
+  lzma_end (&gzdec->lzstrm.strm);
 }
+#endif
 
+#ifdef HAVE_LZ4
 static int
-bzlib_init (GstGzdec * gzdec)
+lz4_init (GstGzdec * gzdec)
 {
-  GST_DEBUG_OBJECT (gzdec, "bzlib init");
-  gzdec->bzstrm.next_in   = NULL;
-  gzdec->bzstrm.avail_in  = 0;
-  gzdec->bzstrm.next_out  = NULL;
-  gzdec->bzstrm.avail_out = 0;
-  gzdec->bzstrm.bzalloc   = NULL;
-  gzdec->bzstrm.bzfree    = NULL;
+  LZ4F_errorCode_t err;
 
-  return BZ2_bzDecompressInit (&gzdec->bzstrm, 0, 0);
+  GST_DEBUG_OBJECT (gzdec, "lz4 init");
+  gzdec->lz4strm.in      = NULL;
+  gzdec->lz4strm.in_len  = 0;
+  gzdec->lz4strm.out     = NULL;
+  gzdec->lz4strm.out_len = 0;
+  gzdec->lz4strm.out_pos = 0;
+  gzdec->lz4strm.started = FALSE;
+  gzdec->lz4strm.finish  = FALSE;
+
+  err = LZ4F_createDecompressionContext (&gzdec->lz4strm.dctx, LZ4F_VERSION);
+  return LZ4F_isError (err) ? -1 : 0;
 }
 
 static void
-bzlib_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+lz4_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
 {
-  gzdec->bzstrm.next_in  = buf;
-  gzdec->bzstrm.avail_in = len;
+  gzdec->lz4strm.in     = buf;
+  gzdec->lz4strm.in_len = len;
 }
 
 static void
-bzlib_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+lz4_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
 {
-  gzdec->bzstrm.next_out  = buf;
-  gzdec->bzstrm.avail_out = len;
+  gzdec->lz4strm.out     = buf;
+  gzdec->lz4strm.out_len = len;
+  gzdec->lz4strm.out_pos = 0;
 }
 
 static size_t
-bzlib_out_buffer_size (GstGzdec * gzdec)
+lz4_out_buffer_size (GstGzdec * gzdec)
 {
-  return gzdec->out_buf_capacity - gzdec->bzstrm.avail_out;
+  return gzdec->lz4strm.out_pos;
+}
+
+static size_t
+lz4_in_buffer_left (GstGzdec * gzdec)
+{
+  return gzdec->lz4strm.in_len;
 }
 
 static int
-bzlib_uncompress_step (GstGzdec * gzdec)
+lz4_uncompress_step (GstGzdec * gzdec)
 {
-  int ret = 0;
-  int err;
+  size_t in_len = gzdec->lz4strm.in_len;
+  size_t out_len = gzdec->lz4strm.out_len - gzdec->lz4strm.out_pos;
+  gboolean finish = gzdec->lz4strm.finish;
+  size_t hint;
+  int ret;
 
-  err = BZ2_bzDecompress (&gzdec->bzstrm);
-  if ((err != BZ_OK) && (err != BZ_STREAM_END)) {
-    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%d\"\n", err);
+  ret = 0;
+
+  // Draining after the end of the last frame
+  if (finish && !gzdec->lz4strm.started)
+    return XZ_END;
+
+  hint = LZ4F_decompress (gzdec->lz4strm.dctx,
+      gzdec->lz4strm.out + gzdec->lz4strm.out_pos, &out_len,
+      gzdec->lz4strm.in, &in_len, NULL);
+  if (LZ4F_isError (hint)) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"%s\"",
+        LZ4F_getErrorName (hint));
     return XZ_ERROR;
   }
+  gzdec->lz4strm.in += in_len;
+  gzdec->lz4strm.in_len -= in_len;
+  gzdec->lz4strm.out_pos += out_len;
+  if (in_len > 0)
+    gzdec->lz4strm.started = TRUE;
 
-  if (err == BZ_STREAM_END) {
-    ret |= XZ_FINISH;
-    if (gzdec->bzstrm.avail_out > 0)
-      ret |= XZ_MORE_OUTPUT;
+  if (hint == 0) {
+    gzdec->lz4strm.started = FALSE;
+    ret |= finish ? XZ_END : XZ_FINISH;
   }
-  if (gzdec->bzstrm.avail_out == 0)
+
+  // Every block is pushed as soon as its input has arrived, LZ4 is meant
+  // for low latency, not for large buffers
+  if (gzdec->lz4strm.out_pos == gzdec->lz4strm.out_len) {
     ret |= XZ_MORE_OUTPUT;
-  if (gzdec->bzstrm.avail_in == 0)
+  } else if (finish && gzdec->lz4strm.started) {
+    GST_DEBUG_OBJECT (gzdec, "Uncompress error: \"truncated frame\"");
+    return XZ_ERROR;
+  } else if (gzdec->lz4strm.in_len == 0 && !finish) {
     ret |= XZ_MORE_INPUT;
+    if (gzdec->lz4strm.out_pos > 0)
+      ret |= XZ_MORE_OUTPUT;
+  }
 
   return ret;
 }
 
+static int
+lz4_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "lz4 reset");
+  LZ4F_resetDecompressionContext (gzdec->lz4strm.dctx);
+  gzdec->lz4strm.started = FALSE;
+  gzdec->lz4strm.finish = FALSE;
+  return 0;
+}
+
 static void
-bzlib_free (GstGzdec * gzdec)
+lz4_drain (GstGzdec * gzdec)
 {
-  GST_DEBUG_OBJECT (gzdec, "bzlib free");
-  BZ2_bzDecompressEnd (&gzdec->bzstrm);
+  GST_DEBUG_OBJECT (gzdec, "lz4 drain");
+  gzdec->lz4strm.finish = TRUE;
+}
+
+static void
+lz4_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "lz4 free");
+  LZ4F_freeDecompressionContext (gzdec->lz4strm.dctx);
+}
+#endif
+
+#ifdef HAVE_LIBDEFLATE
+/* libdeflate only decodes whole streams: the input is gathered until EOS and
+ * decoded at once into a single buffer, pushed like the stored blocks */
+static int
+libdeflate_init (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "libdeflate init");
+  gzdec->ldstrm.dec = libdeflate_alloc_decompressor ();
+  if (!gzdec->ldstrm.dec)
+    return -1;
+  gzdec->ldstrm.in = g_byte_array_new ();
+  gzdec->ldstrm.finish = FALSE;
+  return 0;
+}
+
+static void
+libdeflate_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  g_byte_array_append (gzdec->ldstrm.in, buf, len);
+}
+
+static void
+libdeflate_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+}
+
+static size_t
+libdeflate_out_buffer_size (GstGzdec * gzdec)
+{
+  return 0;
+}
+
+static enum libdeflate_result
+libdeflate_decode (GstGzdec * gzdec, const guint8 * in, size_t in_len,
+    void *out, size_t out_len, size_t * in_used, size_t * out_used)
+{
+  struct libdeflate_decompressor *dec = gzdec->ldstrm.dec;
+
+  switch (gzdec->stream_format) {
+    case GST_GZDEC_FORMAT_GZIP:
+      return libdeflate_gzip_decompress_ex (dec, in, in_len, out, out_len,
+          in_used, out_used);
+    case GST_GZDEC_FORMAT_ZLIB:
+      return libdeflate_zlib_decompress_ex (dec, in, in_len, out, out_len,
+          in_used, out_used);
+    default:
+      return libdeflate_deflate_decompress_ex (dec, in, in_len, out, out_len,
+          in_used, out_used);
+  }
+}
+
+/* Too much input to hold until EOS: go on streaming it with zlib, from the
+ * input gathered so far, kept until zlib is freed */
+static int
+libdeflate_to_zlib (GstGzdec * gzdec)
+{
+  GByteArray *in = gzdec->ldstrm.in;
+  gchar *engine;
+
+  GST_INFO_OBJECT (gzdec, "More than %d input bytes, streaming with zlib",
+      LIBDEFLATE_MAX_INPUT);
+  libdeflate_free_decompressor (gzdec->ldstrm.dec);
+  set_zlib_backend (gzdec, FALSE);
+  if (zlib_init (gzdec) != Z_OK) {
+    g_byte_array_unref (in);
+    return XZ_ERROR;
+  }
+  gzdec->ld_backlog = in;
+
+  // The output buffer taken for libdeflate is still empty
+  if (!gzdec->new_out_buf)
+    zlib_prepare_out_buffer (gzdec, gzdec->out_buf_map.data,
+        gzdec->out_buf_capacity);
+
+  engine = engine_description (gzdec->stream_format, FALSE);
+  GST_OBJECT_LOCK (gzdec);
+  g_free (gzdec->active_engine);
+  gzdec->active_engine = engine;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  zlib_prepare_in_buffer (gzdec, in->data, in->len);
+  return zlib_uncompress_step (gzdec);
+}
+
+static int
+libdeflate_uncompress_step (GstGzdec * gzdec)
+{
+  enum libdeflate_result res;
+  const guint8 *in = gzdec->ldstrm.in->data;
+  size_t in_len = gzdec->ldstrm.in->len;
+  size_t size, in_used, out_used;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gboolean multi_member;
+  guint members = 0;
+
+  if (!gzdec->ldstrm.finish)
+    return in_len > LIBDEFLATE_MAX_INPUT ? libdeflate_to_zlib (gzdec) :
+        XZ_MORE_INPUT;
+
+  GST_OBJECT_LOCK (gzdec);
+  multi_member = gzdec->multi_member;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  while (in_len > 0) {
+    // The gzip trailer gives the size of the last member, exact when there
+    // is only one
+    size = in_len * 4;
+    if (gzdec->stream_format == GST_GZDEC_FORMAT_GZIP && in_len >= 18)
+      size = GST_READ_UINT32_LE (in + in_len - 4);
+    size = MAX (MIN (size, in_len * DEFLATE_MAX_RATIO), 1);
+
+    for (;;) {
+      buf = gst_buffer_new_allocate (NULL, size, NULL);
+      if (!buf) {
+        GST_DEBUG_OBJECT (gzdec, "Can't allocate %" G_GSIZE_FORMAT " bytes",
+            size);
+        return XZ_ERROR;
+      }
+      if (!gst_buffer_map (buf, &map, GST_MAP_WRITE)) {
+        gst_buffer_unref (buf);
+        return XZ_ERROR;
+      }
+      res = libdeflate_decode (gzdec, in, in_len, map.data, map.size,
+          &in_used, &out_used);
+      gst_buffer_unmap (buf, &map);
+      if (res != LIBDEFLATE_INSUFFICIENT_SPACE
+          || size >= in_len * DEFLATE_MAX_RATIO)
+        break;
+      gst_buffer_unref (buf);
+      size = MIN (size * 2, in_len * DEFLATE_MAX_RATIO);
+    }
+
+    if (res != LIBDEFLATE_SUCCESS) {
+      gst_buffer_unref (buf);
+      // Like gzip, ignore garbage (e.g. padding) after the last member
+      if (members > 0) {
+        GST_WARNING_OBJECT (gzdec, "Trailing garbage after %u members "
+            "ignored", members);
+        break;
+      }
+      GST_DEBUG_OBJECT (gzdec, "Uncompress error: %d", res);
+      return XZ_ERROR;
+    }
+
+    GST_DEBUG_OBJECT (gzdec, "Member %u: %" G_GSIZE_FORMAT " -> %"
+        G_GSIZE_FORMAT " bytes", members, in_used, out_used);
+    gst_buffer_set_size (buf, out_used);
+    gzdec->pt_buf = gzdec->pt_buf ? gst_buffer_append (gzdec->pt_buf, buf)
+        : buf;
+    members++;
+    in += in_used;
+    in_len -= in_used;
+
+    if (gzdec->stream_format != GST_GZDEC_FORMAT_GZIP || !multi_member)
+      break;
+  }
+  g_byte_array_set_size (gzdec->ldstrm.in, 0);
+
+  return XZ_END;
+}
+
+static int
+libdeflate_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "libdeflate reset");
+  g_byte_array_set_size (gzdec->ldstrm.in, 0);
+  gzdec->ldstrm.finish = FALSE;
+  return 0;
+}
+
+static void
+libdeflate_drain (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "libdeflate drain");
+  gzdec->ldstrm.finish = TRUE;
+}
+
+static void
+libdeflate_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "libdeflate free");
+  libdeflate_free_decompressor (gzdec->ldstrm.dec);
+  g_byte_array_unref (gzdec->ldstrm.in);
+}
+#endif
+
+/* Parallel bzip2/gzip: the blocks or members are decoded by a pool of
+ * threads, this only feeds the compressed data and reads back the decoded
+ * data in order */
+static int
+parallel_init (GstGzdec * gzdec, GstGzdecParallelFormat format)
+{
+  guint threads;
+  guint max_in_flight;
+  gboolean multi_member;
+
+  GST_OBJECT_LOCK (gzdec);
+  threads = gzdec->threads;
+  max_in_flight = gzdec->max_in_flight;
+  multi_member = gzdec->multi_member;
+  GST_OBJECT_UNLOCK (gzdec);
+
+  GST_DEBUG_OBJECT (gzdec, "parallel init, %u threads", threads);
+  gzdec->pstrm.par = gst_gzdec_parallel_new (format, threads, max_in_flight,
+      multi_member);
+  gzdec->pstrm.out = NULL;
+  gzdec->pstrm.out_len = 0;
+  gzdec->pstrm.out_pos = 0;
+
+  return 0;
+}
+
+static void
+parallel_prepare_in_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gst_gzdec_parallel_push (gzdec->pstrm.par, buf, len);
+}
+
+static void
+parallel_prepare_out_buffer (GstGzdec * gzdec, void *buf, size_t len)
+{
+  gzdec->pstrm.out     = buf;
+  gzdec->pstrm.out_len = len;
+  gzdec->pstrm.out_pos = 0;
+}
+
+static size_t
+parallel_out_buffer_size (GstGzdec * gzdec)
+{
+  return gzdec->pstrm.out_pos;
+}
+
+static int
+parallel_uncompress_step (GstGzdec * gzdec)
+{
+  int ret = 0;
+  gsize written;
+
+  switch (gst_gzdec_parallel_read (gzdec->pstrm.par,
+          gzdec->pstrm.out + gzdec->pstrm.out_pos,
+          gzdec->pstrm.out_len - gzdec->pstrm.out_pos, &written)) {
+    case GST_GZDEC_PARALLEL_OK:
+      break;
+    case GST_GZDEC_PARALLEL_NEED_INPUT:
+      ret |= XZ_MORE_INPUT;
+      break;
+    case GST_GZDEC_PARALLEL_FINISHED:
+      ret |= XZ_END;
+      break;
+    case GST_GZDEC_PARALLEL_ERROR:
+      GST_DEBUG_OBJECT (gzdec, "Uncompress error");
+      return XZ_ERROR;
+  }
+
+  gzdec->pstrm.out_pos += written;
+  if (gzdec->pstrm.out_pos == gzdec->pstrm.out_len)
+    ret |= XZ_MORE_OUTPUT;
+
+  return ret;
+}
+
+static int
+parallel_reset (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "parallel reset");
+  gst_gzdec_parallel_reset (gzdec->pstrm.par);
+  return 0;
+}
+
+static void
+parallel_drain (GstGzdec * gzdec)
+{
+  gst_gzdec_parallel_drain (gzdec->pstrm.par);
+}
+
+static void
+parallel_free (GstGzdec * gzdec)
+{
+  GST_DEBUG_OBJECT (gzdec, "parallel free");
+  gst_gzdec_parallel_free (gzdec->pstrm.par);
+  gzdec->pstrm.par = NULL;
 }
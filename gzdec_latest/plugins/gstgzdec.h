@@ -21,8 +21,26 @@
 #define _GST_GZDEC_H_
 
 #include <gst/gst.h>
-#include <zlib.h>
 #include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "gstgzdeczlib.h"
+#include "gstgzdecparallel.h"
+#include "gstgzdecindex.h"
+#include "gstgzdeclatency.h"
+#include "gstgzdecpool.h"
+#include "gstgzdecarena.h"
 
 G_BEGIN_DECLS
 
@@ -30,11 +48,88 @@ G_BEGIN_DECLS
 #define GST_GZDEC(obj)          (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_GZDEC, GstGzdec))
 #define GST_GZDEC_CLASS(klass)  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_GZDEC, GstGzdecClass))
 #define GST_IS_GZDEC(obj)       (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_GZDEC))
-#define GST_IS_GZDEC_CLASS(obj) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_GZDEC))
+#define GST_IS_GZDEC_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_GZDEC))
 
 typedef struct _GstGzdec GstGzdec;
 typedef struct _GstGzdecClass GstGzdecClass;
 
+/**
+ * GstGzdecBufferMode:
+ * @GST_GZDEC_BUFFER_MODE_ADAPTIVE: size output buffers from the observed
+ *   compression ratio, so one input buffer ends up in about one output buffer
+ * @GST_GZDEC_BUFFER_MODE_FIXED: all output buffers have the target size
+ *
+ * Policy used to choose the size of the output buffers.
+ */
+typedef enum
+{
+  GST_GZDEC_BUFFER_MODE_ADAPTIVE,
+  GST_GZDEC_BUFFER_MODE_FIXED
+} GstGzdecBufferMode;
+
+#define GST_TYPE_GZDEC_BUFFER_MODE (gst_gzdec_buffer_mode_get_type ())
+GType gst_gzdec_buffer_mode_get_type (void);
+
+/**
+ * GstGzdecFormat:
+ * @GST_GZDEC_FORMAT_AUTO: detect the format from the first bytes of the
+ *   stream, falling back to the sink caps and then to raw deflate
+ * @GST_GZDEC_FORMAT_GZIP: gzip (RFC 1952)
+ * @GST_GZDEC_FORMAT_ZLIB: zlib stream (RFC 1950)
+ * @GST_GZDEC_FORMAT_DEFLATE: raw deflate data (RFC 1951)
+ * @GST_GZDEC_FORMAT_BZIP2: bzip2
+ * @GST_GZDEC_FORMAT_ZSTD: Zstandard, when built with libzstd
+ * @GST_GZDEC_FORMAT_XZ: xz, when built with liblzma
+ * @GST_GZDEC_FORMAT_LZ4: LZ4 frames, when built with liblz4
+ *
+ * Compressed format of the input.
+ */
+typedef enum
+{
+  GST_GZDEC_FORMAT_AUTO,
+  GST_GZDEC_FORMAT_GZIP,
+  GST_GZDEC_FORMAT_ZLIB,
+  GST_GZDEC_FORMAT_DEFLATE,
+  GST_GZDEC_FORMAT_BZIP2,
+  GST_GZDEC_FORMAT_ZSTD,
+  GST_GZDEC_FORMAT_XZ,
+  GST_GZDEC_FORMAT_LZ4
+} GstGzdecFormat;
+
+#define GST_TYPE_GZDEC_FORMAT (gst_gzdec_format_get_type ())
+GType gst_gzdec_format_get_type (void);
+
+/**
+ * GstGzdecEngine:
+ * @GST_GZDEC_ENGINE_AUTO: let gzdec choose
+ * @GST_GZDEC_ENGINE_ZLIB: streaming inflate, with zlib-ng instead of zlib
+ *   when built with it
+ * @GST_GZDEC_ENGINE_LIBDEFLATE: keep the whole input in memory and decode
+ *   it at once with libdeflate, when built with it
+ *
+ * Library decoding gzip, zlib and raw deflate streams.
+ */
+typedef enum
+{
+  GST_GZDEC_ENGINE_AUTO,
+  GST_GZDEC_ENGINE_ZLIB,
+  GST_GZDEC_ENGINE_LIBDEFLATE
+} GstGzdecEngine;
+
+#define GST_TYPE_GZDEC_ENGINE (gst_gzdec_engine_get_type ())
+GType gst_gzdec_engine_get_type (void);
+
+/* Counters of the decoding, published by the "stats" property */
+typedef struct
+{
+  guint64 bytes_in;
+  guint64 bytes_out;
+  guint64 buffers_in;
+  guint64 buffers_out;
+  GstClockTime decode_time;     /* spent in the backend uncompress step */
+  GstClockTime max_latency;     /* longest time handling an input buffer */
+} GstGzdecStats;
+
 struct _GstGzdec
 {
   GstElement element;
@@ -45,19 +140,234 @@ struct _GstGzdec
   GstBuffer *out_buf;
   GstMapInfo out_buf_map;
 
+  /* Output buffer pool, negotiated with downstream or our own. Set under
+   * the object lock, for flushes to unblock the streaming thread */
+  GstBufferPool *pool;
+  gboolean own_pool;
+  size_t pool_buffer_size;
+  guint pool_buffers;
+
   union
   {
-    z_stream zstrm;
+    z_stream *zstrm;            /* from the process wide pool */
     bz_stream bzstrm;
+#ifdef HAVE_ZSTD
+    struct
+    {
+      ZSTD_DCtx *dctx;
+      ZSTD_inBuffer in;
+      ZSTD_outBuffer out;
+    } zstdstrm;
+#endif
+#ifdef HAVE_LZMA
+    struct
+    {
+      lzma_stream strm;
+      gboolean started;         /* input given since the stream start */
+      gboolean finish;          /* no more input, flush the decoder */
+    } lzstrm;
+#endif
+#ifdef HAVE_LZ4
+    struct
+    {
+      LZ4F_dctx *dctx;
+      const guint8 *in;
+      size_t in_len;
+      guint8 *out;
+      size_t out_len;
+      size_t out_pos;
+      gboolean started;         /* input given since the frame start */
+      gboolean finish;          /* no more input, the frame must be over */
+    } lz4strm;
+#endif
+#ifdef HAVE_LIBDEFLATE
+    struct
+    {
+      struct libdeflate_decompressor *dec;
+      GByteArray *in;           /* whole input, decoded when draining */
+      gboolean finish;
+    } ldstrm;
+#endif
+    struct
+    {
+      GstGzdecParallel *par;
+      guint8 *out;
+      size_t out_len;
+      size_t out_pos;
+    } pstrm;
   };
 
   gboolean xz_initialized;
+  GstGzdecFormat stream_format;
   gboolean new_out_buf;
   size_t out_buf_capacity;
+
+  /* Output buffer sizing */
+  GstGzdecBufferMode buffer_mode;
+  guint min_buffer_size;
+  guint max_buffer_size;
+  guint target_buffer_size;
+  guint64 ratio_in;
+  guint64 ratio_out;
+
+  /* Input format, forced or detected on the first buffer */
+  GstGzdecFormat format;
+  GstGzdecFormat caps_format;   /* hint from the sink caps */
+  GstBuffer *sniff_buf;         /* first bytes, too few to be detected */
+
+  /* zstd decoding parameters */
+  guint window_log_max;
+  gchar *dictionary_location;
+
+  /* xz decoder memory limit, 0 means unlimited */
+  guint64 memory_limit;
+
+  /* zlib and bzip2 states allocated from the process wide arena, reserving
+   * this many bytes of it, and the arena memory they hold */
+  guint64 arena_size;
+  GstGzdecArenaUsage arena_usage;
+
+  /* Deflate engine asked for, and library of the running backend */
+  GstGzdecEngine engine;
+  gchar *active_engine;
+
+  /* Output caps, found by typefinding the first decoded buffer. The segment
+   * waits for them, and the sticky events after it wait behind it */
+  gboolean src_caps_set;
+  GstEvent *pending_segment;
+  GList *pending_events;
+
+  gboolean multi_member;
+  guint members;
+  guint64 member_out;
+
+  /* gzip members found whole in an input buffer are decoded at once */
+  gboolean whole_member;
+#ifdef HAVE_LIBDEFLATE
+  struct libdeflate_decompressor *whole_dec;
+  /* Input gathered by libdeflate past the limit, read by zlib instead */
+  GByteArray *ld_backlog;
+#endif
+
+  /* Stored deflate blocks pushed as sub-buffers of the input, gzip only */
+  gboolean zero_copy_stored;
+  const guint8 *in_start;
+  gboolean zc_raw;              /* past a stored block, the trailer is ours */
+  guint32 zc_crc;
+  guint64 zc_size;
+  gboolean zc_stored;           /* inside a stored block */
+  gboolean zc_final;
+  gboolean zc_resume;           /* restarted raw after a stored block */
+  gsize zc_stored_left;
+  gboolean zc_trailer;          /* reading the gzip trailer */
+  guint zc_trailer_len;
+  guint8 zc_trailer_buf[8];
+  guint8 *zc_window;
+  guint zc_window_len;
+  gsize pt_offset;
+  gsize pt_len;
+  GstBuffer *pt_buf;
+
+  /* Decoding threads, 1 means decoding in the streaming thread */
+  guint threads;
+  guint max_in_flight;
+  size_t last_in_size;
+
+  /* Decoding in a src pad task, fed by a bounded queue of input buffers and
+   * serialized events, instead of in the upstream streaming thread */
+  gboolean decode_thread;
+  guint max_size_buffers;
+  guint max_size_bytes;
+  guint64 max_size_time;
+  gboolean task_active;         /* task started at the pad activation */
+  GMutex queue_lock;
+  GCond queue_cond;
+  GQueue queue;
+  guint queue_buffers;
+  guint64 queue_bytes;
+  GstFlowReturn queue_result;   /* why the task stopped, or GST_FLOW_OK */
+
+  /* Pull mode random access, gzip only. pull_mode and pull_out are written
+   * under the object lock, for the POSITION query */
+  gboolean pull_mode;
+  z_stream pull_zstrm;
+  gboolean pull_raw;            /* restarted at a checkpoint, no gzip wrapper */
+  guint pull_skip;              /* gzip trailer bytes still to skip */
+  gboolean pull_done;
+  GstBuffer *pull_buf;
+  GstMapInfo pull_map;
+  guint64 pull_in;              /* compressed offset of the next pull */
+  guint64 pull_out;             /* uncompressed offset of the next output */
+  guint8 *pull_scratch;
+  GstGzdecIndex *index;
+  guint64 index_interval;
+  guint64 pull_interval;
+
+  /* Index file, validated against the input file size and mtime */
+  gchar *index_file;
+  gboolean use_index_file;
+  gchar *index_path;
+  guint64 src_size;
+  gint64 src_mtime;
+
+  /* Push mode byte seeks, sent upstream at the checkpoint of a complete
+   * index file before the position. Set by the seek and taken by the
+   * FLUSH_STOP with its seqnum, under the object lock */
+  gboolean raw_restart;         /* the backend can start at a checkpoint */
+  gboolean index_tried;         /* index file looked for in push mode */
+  gboolean seek_pending;
+  guint32 seek_seqnum;
+  const GstGzdecCheckpoint *seek_point;        /* NULL for the start */
+  guint64 seek_offset;
+
+  /* Where the zlib backend restarts on the next input after a seek, and the
+   * decoded bytes it drops up to the position sought */
+  const GstGzdecCheckpoint *seek_restart;
+  guint64 seek_discard;
+  gboolean zlib_raw;            /* restarted raw, the trailer is ours */
+  guint zlib_skip;              /* trailer bytes still to skip */
+
+  /* Bytes pushed, and total size from the gzip trailer (0 when unknown),
+   * written under the object lock */
+  guint64 total_out;
+  guint64 duration;
+
+  /* Timestamps of the input buffer being decoded, spread over its compressed
+   * bytes to stamp the output buffers */
+  GstClockTime in_pts;
+  GstClockTime in_duration;     /* given, or from the previous input buffer */
+  guint64 in_pos;               /* compressed offset of the input buffer */
+  gsize in_len;
+  GstClockTime prev_in_pts;
+  guint64 prev_in_pos;
+  GstClockTime out_pts;         /* time of the first byte of out_buf */
+  GstClockTime pt_pts;          /* and of pt_buf */
+  gboolean discont;             /* the next buffer pushed follows a gap */
+
+  /* Statistics under the object lock, and counted by the streaming thread
+   * since they were last added */
+  GstGzdecStats stats;
+  GstGzdecStats stats_pending;
+  GstClockTime stats_interval;
+  GstClockTime stats_last_post;
+
+  /* Decoded data pushed in a shorter buffer once it has waited this long,
+   * from the time the first byte of out_buf was decoded */
+  GstClockTime max_latency;
+  GstClockTime out_since;
+  GstClockTime last_in_time;    /* input buffer arrivals */
+  GstClockTime in_gap;
+
+  /* Step timings, while the gzdec-latency tracer is loaded */
+  GstGzdecLatency *latency;
+
   void (*xz_free) (GstGzdec * gzdec);
+  int (*xz_reset) (GstGzdec * gzdec);
+  void (*xz_drain) (GstGzdec * gzdec);
   void (*xz_prepare_in_buffer) (GstGzdec * gzdec, void *buf, size_t len);
   void (*xz_prepare_out_buffer) (GstGzdec * gzdec, void *buf, size_t len);
   size_t (*xz_out_buffer_size) (GstGzdec * gzdec);
+  size_t (*xz_in_buffer_left) (GstGzdec * gzdec);
   int (*xz_uncompress_step) (GstGzdec * gzdec);
 };
 
@@ -0,0 +1,364 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "gstgzdecarena.h"
+
+#define REGION GST_GZDEC_ARENA_REGION
+#define REGION_MASK ((guintptr) REGION - 1)
+
+/* Blocks from 64 bytes to half a region, larger allocations are mapped on
+ * their own */
+#define MIN_SHIFT 6
+#define MAX_SHIFT 20
+#define N_CLASSES (MAX_SHIFT - MIN_SHIFT + 1)
+
+/* Large allocations kept once freed, bzip2 asking for the same sizes on
+ * every stream of a given block size */
+#define LARGE_IDLE_MAX 4
+
+#define PAGE 4096
+
+typedef struct
+{
+  guint8 *base;                 /* aligned on REGION */
+  gsize size;                   /* REGION, or more for a large allocation */
+  gint shift;                   /* block size, 0 when free, -1 when large */
+  gpointer mem;                 /* allocation to free, without mmap */
+} Region;
+
+G_LOCK_DEFINE_STATIC (arena);
+static GHashTable *regions = NULL;      /* base -> Region */
+static gpointer free_blocks[N_CLASSES]; /* linked through their first bytes */
+static GSList *free_regions = NULL;
+static GSList *idle_large = NULL;
+static guint idle_large_len = 0;
+static gsize mapped = 0;
+static gboolean no_hugetlb = FALSE;
+
+#ifdef HAVE_SYS_MMAN_H
+/* @size bytes aligned on REGION, from the huge page pool when some pages
+ * were set aside for it, or else advised to be backed by transparent huge
+ * pages */
+static guint8 *
+map_aligned (gsize size, gpointer * alloc)
+{
+  guint8 *mem, *base;
+  gsize head;
+
+  *alloc = NULL;
+
+#if defined (MAP_HUGETLB) && defined (MAP_HUGE_SHIFT)
+  if (!no_hugetlb) {
+    mem = mmap (NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT),
+        -1, 0);
+    if (mem != MAP_FAILED)
+      return mem;
+    no_hugetlb = TRUE;
+  }
+#endif
+
+  mem = mmap (NULL, size + REGION, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return NULL;
+
+  base = (guint8 *) (((guintptr) mem + REGION_MASK) & ~REGION_MASK);
+  head = base - mem;
+  if (head > 0)
+    munmap (mem, head);
+  munmap (base + size, REGION - head);
+#ifdef MADV_HUGEPAGE
+  madvise (base, size, MADV_HUGEPAGE);
+#endif
+
+  return base;
+}
+
+static void
+unmap (Region * region)
+{
+  munmap (region->base, region->size);
+}
+#else
+/* Without mmap, @size bytes aligned on REGION in a larger allocation */
+static guint8 *
+map_aligned (gsize size, gpointer * alloc)
+{
+  guint8 *mem = g_try_malloc (size + REGION);
+
+  *alloc = mem;
+  if (!mem)
+    return NULL;
+
+  return (guint8 *) (((guintptr) mem + REGION_MASK) & ~REGION_MASK);
+}
+
+static void
+unmap (Region * region)
+{
+  g_free (region->mem);
+}
+#endif
+
+static Region *
+region_new (guint8 * base, gsize size, gint shift, gpointer alloc)
+{
+  Region *region = g_new (Region, 1);
+
+  region->base = base;
+  region->size = size;
+  region->shift = shift;
+  region->mem = alloc;
+
+  if (!regions)
+    regions = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_hash_table_insert (regions, base, region);
+  mapped += size;
+
+  return region;
+}
+
+/* Count @size bytes more, or less, in @usage and its parents */
+static void
+usage_add (GstGzdecArenaUsage * usage, gssize size)
+{
+  for (; usage; usage = usage->parent) {
+    usage->bytes += size;
+    usage->peak = MAX (usage->peak, usage->bytes);
+  }
+}
+
+/* Cut a new region in blocks of 1 << @shift bytes */
+static gboolean
+refill (gint shift)
+{
+  gsize block = (gsize) 1 << shift;
+  Region *region = NULL;
+  gpointer alloc;
+  guint8 *base;
+  gsize off;
+
+  if (free_regions) {
+    region = free_regions->data;
+    free_regions = g_slist_delete_link (free_regions, free_regions);
+    region->shift = shift;
+  } else if ((base = map_aligned (REGION, &alloc))) {
+    region = region_new (base, REGION, shift, alloc);
+  } else {
+    return FALSE;
+  }
+
+  for (off = REGION; off > 0; off -= block) {
+    base = region->base + off - block;
+    *(gpointer *) base = free_blocks[shift - MIN_SHIFT];
+    free_blocks[shift - MIN_SHIFT] = base;
+  }
+
+  return TRUE;
+}
+
+static Region *
+alloc_large (gsize size)
+{
+  Region *region;
+  gpointer alloc;
+  GSList *l;
+  guint8 *base;
+
+  size = (size + REGION_MASK) & ~REGION_MASK;
+  for (l = idle_large; l; l = l->next) {
+    region = l->data;
+    if (region->size == size) {
+      idle_large = g_slist_delete_link (idle_large, l);
+      idle_large_len--;
+      return region;
+    }
+  }
+
+  if (!(base = map_aligned (size, &alloc)))
+    return NULL;
+  return region_new (base, size, -1, alloc);
+}
+
+static void
+free_large (Region * region)
+{
+  if (idle_large_len < LARGE_IDLE_MAX) {
+    idle_large = g_slist_prepend (idle_large, region);
+    idle_large_len++;
+    return;
+  }
+
+  mapped -= region->size;
+  unmap (region);
+  g_hash_table_remove (regions, region->base);
+}
+
+/* Map enough regions for the arena to hold @size bytes, touching them so
+ * the first streams don't take the page faults */
+void
+gst_gzdec_arena_reserve (gsize size)
+{
+  gpointer alloc;
+  guint8 *base, *p;
+  gsize len;
+
+  G_LOCK (arena);
+  if (size > mapped) {
+    len = (size - mapped + REGION_MASK) & ~REGION_MASK;
+    if ((base = map_aligned (len, &alloc))) {
+      for (p = base; p < base + len; p += PAGE)
+        *p = 0;
+      // Never given back, nothing to free
+      for (p = base; p < base + len; p += REGION)
+        free_regions = g_slist_prepend (free_regions,
+            region_new (p, REGION, 0, NULL));
+    }
+  }
+  G_UNLOCK (arena);
+}
+
+/* @size bytes counted in @usage, or NULL when no memory could be mapped */
+gpointer
+gst_gzdec_arena_alloc (GstGzdecArenaUsage * usage, gsize size)
+{
+  Region *region;
+  gpointer mem = NULL;
+  gint shift = MIN_SHIFT;
+
+  while (shift <= MAX_SHIFT && ((gsize) 1 << shift) < size)
+    shift++;
+
+  G_LOCK (arena);
+  if (shift > MAX_SHIFT) {
+    if ((region = alloc_large (size))) {
+      mem = region->base;
+      usage_add (usage, region->size);
+    }
+  } else if (free_blocks[shift - MIN_SHIFT] || refill (shift)) {
+    mem = free_blocks[shift - MIN_SHIFT];
+    free_blocks[shift - MIN_SHIFT] = *(gpointer *) mem;
+    usage_add (usage, (gssize) 1 << shift);
+  }
+  G_UNLOCK (arena);
+
+  return mem;
+}
+
+void
+gst_gzdec_arena_free (GstGzdecArenaUsage * usage, gpointer mem)
+{
+  Region *region;
+
+  if (!mem)
+    return;
+
+  G_LOCK (arena);
+  region = g_hash_table_lookup (regions,
+      (gpointer) ((guintptr) mem & ~REGION_MASK));
+  if (!region) {
+    G_UNLOCK (arena);
+    g_warn_if_reached ();
+    return;
+  }
+
+  if (region->shift < 0) {
+    usage_add (usage, -(gssize) region->size);
+    free_large (region);
+  } else {
+    usage_add (usage, -((gssize) 1 << region->shift));
+    *(gpointer *) mem = free_blocks[region->shift - MIN_SHIFT];
+    free_blocks[region->shift - MIN_SHIFT] = mem;
+  }
+  G_UNLOCK (arena);
+}
+
+/* Count the bytes held by @usage in @parent too, until detached */
+void
+gst_gzdec_arena_attach (GstGzdecArenaUsage * usage,
+    GstGzdecArenaUsage * parent)
+{
+  G_LOCK (arena);
+  usage->parent = parent;
+  usage_add (parent, usage->bytes);
+  G_UNLOCK (arena);
+}
+
+void
+gst_gzdec_arena_detach (GstGzdecArenaUsage * usage)
+{
+  G_LOCK (arena);
+  usage_add (usage->parent, -(gssize) usage->bytes);
+  usage->parent = NULL;
+  G_UNLOCK (arena);
+}
+
+/* Bytes held by @usage, and the most it held */
+void
+gst_gzdec_arena_usage (GstGzdecArenaUsage * usage, gsize * bytes,
+    gsize * peak)
+{
+  G_LOCK (arena);
+  *bytes = usage->bytes;
+  *peak = usage->peak;
+  G_UNLOCK (arena);
+}
+
+void
+gst_gzdec_arena_reset_peak (GstGzdecArenaUsage * usage)
+{
+  G_LOCK (arena);
+  usage->peak = usage->bytes;
+  G_UNLOCK (arena);
+}
+
+void *
+gst_gzdec_arena_zalloc (void *opaque, unsigned int items, unsigned int size)
+{
+  return gst_gzdec_arena_alloc (opaque, (gsize) items * size);
+}
+
+void
+gst_gzdec_arena_zfree (void *opaque, void *address)
+{
+  gst_gzdec_arena_free (opaque, address);
+}
+
+void *
+gst_gzdec_arena_bzalloc (void *opaque, int items, int size)
+{
+  if (items < 0 || size < 0)
+    return NULL;
+  return gst_gzdec_arena_alloc (opaque, (gsize) items * size);
+}
+
+void
+gst_gzdec_arena_bzfree (void *opaque, void *address)
+{
+  gst_gzdec_arena_free (opaque, address);
+}
@@ -0,0 +1,68 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_ARENA_H_
+#define _GST_GZDEC_ARENA_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Process wide arena the zlib and bzip2 states are allocated from. Memory
+ * is mapped in regions of GST_GZDEC_ARENA_REGION bytes, backed by huge pages
+ * when the system has them (allocated with malloc where there is no mmap),
+ * and cut in blocks of a power of two size. Freed blocks are kept for the
+ * next stream, nothing is given back to the system but the allocations
+ * larger than half a region */
+#define GST_GZDEC_ARENA_REGION (2 * 1024 * 1024)
+
+typedef struct _GstGzdecArenaUsage GstGzdecArenaUsage;
+
+/* Bytes of the arena held through an opaque pointer of the callbacks, also
+ * counted in @parent while attached to it */
+struct _GstGzdecArenaUsage
+{
+  gsize bytes;
+  gsize peak;
+  GstGzdecArenaUsage *parent;
+};
+
+void gst_gzdec_arena_reserve (gsize size);
+
+gpointer gst_gzdec_arena_alloc (GstGzdecArenaUsage * usage, gsize size);
+void gst_gzdec_arena_free (GstGzdecArenaUsage * usage, gpointer mem);
+
+void gst_gzdec_arena_attach (GstGzdecArenaUsage * usage,
+    GstGzdecArenaUsage * parent);
+void gst_gzdec_arena_detach (GstGzdecArenaUsage * usage);
+void gst_gzdec_arena_usage (GstGzdecArenaUsage * usage, gsize * bytes,
+    gsize * peak);
+void gst_gzdec_arena_reset_peak (GstGzdecArenaUsage * usage);
+
+/* zalloc/zfree and bzalloc/bzfree callbacks, with a GstGzdecArenaUsage as
+ * opaque pointer */
+void *gst_gzdec_arena_zalloc (void *opaque, unsigned int items,
+    unsigned int size);
+void gst_gzdec_arena_zfree (void *opaque, void *address);
+void *gst_gzdec_arena_bzalloc (void *opaque, int items, int size);
+void gst_gzdec_arena_bzfree (void *opaque, void *address);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,308 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "gstgzdecindex.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_gzdec_index_debug);
+#define GST_CAT_DEFAULT gst_gzdec_index_debug
+
+#define WINDOW_SIZE     32768
+
+/* Index file layout, all integers little endian:
+ *   header: magic, version, compressed size, mtime, total output size,
+ *     number of checkpoints and flags
+ *   checkpoints: out, in, bits and window length
+ *   windows: the window of every checkpoint, in order */
+#define FILE_MAGIC          "GZIX"
+#define FILE_VERSION        2
+#define FILE_HEADER_SIZE    40
+#define FILE_POINT_SIZE     24
+
+static void
+debug_init (void)
+{
+  static gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    GST_DEBUG_CATEGORY_INIT (gst_gzdec_index_debug, "gzdecindex", 0,
+        "gzdec random access index");
+    g_once_init_leave (&done, 1);
+  }
+}
+
+GstGzdecIndex *
+gst_gzdec_index_new (void)
+{
+  GstGzdecIndex *index = g_new0 (GstGzdecIndex, 1);
+
+  debug_init ();
+
+  index->points = g_array_new (FALSE, FALSE, sizeof (GstGzdecCheckpoint));
+
+  return index;
+}
+
+void
+gst_gzdec_index_free (GstGzdecIndex * index)
+{
+  guint i;
+
+  if (index->map) {
+    g_mapped_file_unref (index->map);
+  } else {
+    for (i = 0; i < index->points->len; i++)
+      g_free (g_array_index (index->points, GstGzdecCheckpoint, i).window);
+  }
+  g_array_free (index->points, TRUE);
+  g_free (index);
+}
+
+/* Uncompressed offset of the last checkpoint, 0 when there is none */
+guint64
+gst_gzdec_index_last_offset (GstGzdecIndex * index)
+{
+  if (index->points->len == 0)
+    return 0;
+
+  return g_array_index (index->points, GstGzdecCheckpoint,
+      index->points->len - 1).out;
+}
+
+/* Add a checkpoint for the current position of @strm, which must be at a
+ * deflate block boundary (inflate() with Z_BLOCK). Points are only added
+ * past the last one, so the index grows with the furthest decoded data */
+void
+gst_gzdec_index_add (GstGzdecIndex * index, z_stream * strm, guint64 in,
+    guint64 out)
+{
+  GstGzdecCheckpoint point;
+  uInt len = WINDOW_SIZE;
+
+  if (index->complete
+      || (index->points->len > 0 && out <= gst_gzdec_index_last_offset (index)))
+    return;
+
+  point.out = out;
+  point.in = in;
+  point.bits = strm->data_type & 7;
+  point.window = g_malloc (WINDOW_SIZE);
+  inflateGetDictionary (strm, point.window, &len);
+  point.window_len = len;
+
+  GST_LOG ("Checkpoint at %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT
+      " compressed)", out, in);
+  g_array_append_val (index->points, point);
+}
+
+/* Last checkpoint at or before @offset, or NULL */
+const GstGzdecCheckpoint *
+gst_gzdec_index_lookup (GstGzdecIndex * index, guint64 offset)
+{
+  GstGzdecCheckpoint *points = (GstGzdecCheckpoint *) index->points->data;
+  guint lo = 0;
+  guint hi = index->points->len;
+  guint mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (points[mid].out <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo > 0 ? &points[lo - 1] : NULL;
+}
+
+/* Set up @strm, an already initialized inflate stream, to continue decoding
+ * at @point. The input must be fed from point->in, @prev_byte being the
+ * byte before it when point->bits isn't 0 */
+int
+gst_gzdec_index_restore (const GstGzdecCheckpoint * point, z_stream * strm,
+    guint8 prev_byte)
+{
+  int err;
+
+  err = inflateReset2 (strm, -MAX_WBITS);
+  if (err != Z_OK)
+    return err;
+
+  if (point->bits) {
+    err = inflatePrime (strm, point->bits, prev_byte >> (8 - point->bits));
+    if (err != Z_OK)
+      return err;
+  }
+
+  return inflateSetDictionary (strm, point->window, point->window_len);
+}
+
+void
+gst_gzdec_index_set_complete (GstGzdecIndex * index, guint64 total_out)
+{
+  index->complete = TRUE;
+  index->total_out = total_out;
+}
+
+/* Map an index file. Returns NULL if it doesn't exist, is invalid, or was
+ * made for a different version of the compressed file or with other
+ * @flags */
+GstGzdecIndex *
+gst_gzdec_index_load (const gchar * path, guint64 size, gint64 mtime,
+    guint flags)
+{
+  GstGzdecIndex *index;
+  GstGzdecCheckpoint point;
+  GMappedFile *map;
+  const guint8 *data, *p;
+  gsize len, pos;
+  guint32 n_points, i;
+
+  debug_init ();
+
+  map = g_mapped_file_new (path, FALSE, NULL);
+  if (!map) {
+    GST_DEBUG ("No index file %s", path);
+    return NULL;
+  }
+
+  data = (const guint8 *) g_mapped_file_get_contents (map);
+  len = g_mapped_file_get_length (map);
+  if (len < FILE_HEADER_SIZE || memcmp (data, FILE_MAGIC, 4) != 0
+      || GST_READ_UINT32_LE (data + 4) != FILE_VERSION)
+    goto invalid;
+
+  if (GST_READ_UINT64_LE (data + 8) != size
+      || (gint64) GST_READ_UINT64_LE (data + 16) != mtime) {
+    GST_DEBUG ("Index file %s is outdated", path);
+    goto drop;
+  }
+
+  if (GST_READ_UINT32_LE (data + 36) != flags) {
+    GST_DEBUG ("Index file %s was made with other settings", path);
+    goto drop;
+  }
+
+  n_points = GST_READ_UINT32_LE (data + 32);
+  if (n_points > (len - FILE_HEADER_SIZE) / FILE_POINT_SIZE)
+    goto invalid;
+
+  index = gst_gzdec_index_new ();
+  index->map = map;
+  index->flags = flags;
+  gst_gzdec_index_set_complete (index, GST_READ_UINT64_LE (data + 24));
+
+  pos = FILE_HEADER_SIZE + (gsize) n_points * FILE_POINT_SIZE;
+  for (i = 0; i < n_points; i++) {
+    p = data + FILE_HEADER_SIZE + i * FILE_POINT_SIZE;
+    point.out = GST_READ_UINT64_LE (p);
+    point.in = GST_READ_UINT64_LE (p + 8);
+    point.bits = GST_READ_UINT32_LE (p + 16);
+    point.window_len = GST_READ_UINT32_LE (p + 20);
+    if (point.bits > 7 || point.window_len > WINDOW_SIZE
+        || point.window_len > len - pos
+        || point.out < gst_gzdec_index_last_offset (index)) {
+      // The map is released below, and the windows are in it
+      g_array_set_size (index->points, 0);
+      index->map = NULL;
+      gst_gzdec_index_free (index);
+      goto invalid;
+    }
+
+    point.window = (guint8 *) data + pos;
+    pos += point.window_len;
+    g_array_append_val (index->points, point);
+  }
+
+  GST_DEBUG ("Loaded %u checkpoints from %s", n_points, path);
+  return index;
+
+invalid:
+  GST_WARNING ("Invalid index file %s", path);
+drop:
+  g_mapped_file_unref (map);
+  return NULL;
+}
+
+/* Write the index next to the compressed file. It's written to a temporary
+ * file renamed at the end, so readers never see a partial index */
+gboolean
+gst_gzdec_index_save (GstGzdecIndex * index, const gchar * path,
+    guint64 size, gint64 mtime)
+{
+  GstGzdecCheckpoint *point;
+  guint8 header[FILE_HEADER_SIZE];
+  guint8 entry[FILE_POINT_SIZE];
+  gchar *tmp_path;
+  gboolean ok;
+  FILE *f;
+  guint i;
+
+  g_return_val_if_fail (index->complete, FALSE);
+
+  tmp_path = g_strconcat (path, ".tmp", NULL);
+  f = g_fopen (tmp_path, "wb");
+  if (!f) {
+    GST_WARNING ("Can't create index file %s", tmp_path);
+    g_free (tmp_path);
+    return FALSE;
+  }
+
+  memcpy (header, FILE_MAGIC, 4);
+  GST_WRITE_UINT32_LE (header + 4, FILE_VERSION);
+  GST_WRITE_UINT64_LE (header + 8, size);
+  GST_WRITE_UINT64_LE (header + 16, mtime);
+  GST_WRITE_UINT64_LE (header + 24, index->total_out);
+  GST_WRITE_UINT32_LE (header + 32, index->points->len);
+  GST_WRITE_UINT32_LE (header + 36, index->flags);
+  ok = fwrite (header, sizeof (header), 1, f) == 1;
+
+  for (i = 0; ok && i < index->points->len; i++) {
+    point = &g_array_index (index->points, GstGzdecCheckpoint, i);
+    GST_WRITE_UINT64_LE (entry, point->out);
+    GST_WRITE_UINT64_LE (entry + 8, point->in);
+    GST_WRITE_UINT32_LE (entry + 16, point->bits);
+    GST_WRITE_UINT32_LE (entry + 20, point->window_len);
+    ok = fwrite (entry, sizeof (entry), 1, f) == 1;
+  }
+
+  for (i = 0; ok && i < index->points->len; i++) {
+    point = &g_array_index (index->points, GstGzdecCheckpoint, i);
+    ok = fwrite (point->window, 1, point->window_len, f) == point->window_len;
+  }
+
+  ok = (fclose (f) == 0) && ok;
+  if (ok)
+    ok = g_rename (tmp_path, path) == 0;
+  if (!ok) {
+    GST_WARNING ("Failed to write index file %s", path);
+    g_unlink (tmp_path);
+  } else {
+    GST_DEBUG ("Saved %u checkpoints to %s", index->points->len, path);
+  }
+
+  g_free (tmp_path);
+  return ok;
+}
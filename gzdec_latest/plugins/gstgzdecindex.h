@@ -0,0 +1,78 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_INDEX_H_
+#define _GST_GZDEC_INDEX_H_
+
+#include <gst/gst.h>
+#include "gstgzdeczlib.h"
+
+G_BEGIN_DECLS
+
+/* Random access index of a deflate stream, zran style: every checkpoint
+ * holds what inflate needs to restart decoding in the middle of the stream,
+ * the position in both streams and the window of previous output */
+typedef struct _GstGzdecIndex GstGzdecIndex;
+
+typedef struct
+{
+  guint64 out;                  /* uncompressed offset */
+  guint64 in;                   /* compressed offset of the next full byte */
+  guint bits;                   /* bits of the byte before in still to use */
+  guint window_len;
+  guint8 *window;               /* output preceding out, up to 32 KiB */
+} GstGzdecCheckpoint;
+
+/* Settings the decoded stream depends on, an index is only valid with the
+ * same ones */
+#define GST_GZDEC_INDEX_MULTI_MEMBER (1 << 0)
+
+struct _GstGzdecIndex
+{
+  GArray *points;               /* sorted by offset */
+  guint flags;                  /* GST_GZDEC_INDEX_* */
+
+  /* Set once the whole stream has been decoded */
+  gboolean complete;
+  guint64 total_out;
+
+  /* Loaded from a file, the windows point into it */
+  GMappedFile *map;
+};
+
+GstGzdecIndex *gst_gzdec_index_new (void);
+void gst_gzdec_index_free (GstGzdecIndex * index);
+
+guint64 gst_gzdec_index_last_offset (GstGzdecIndex * index);
+void gst_gzdec_index_add (GstGzdecIndex * index, z_stream * strm,
+    guint64 in, guint64 out);
+const GstGzdecCheckpoint *gst_gzdec_index_lookup (GstGzdecIndex * index,
+    guint64 offset);
+int gst_gzdec_index_restore (const GstGzdecCheckpoint * point,
+    z_stream * strm, guint8 prev_byte);
+void gst_gzdec_index_set_complete (GstGzdecIndex * index, guint64 total_out);
+
+GstGzdecIndex *gst_gzdec_index_load (const gchar * path, guint64 size,
+    gint64 mtime, guint flags);
+gboolean gst_gzdec_index_save (GstGzdecIndex * index, const gchar * path,
+    guint64 size, gint64 mtime);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,199 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "gstgzdeclatency.h"
+
+/* Tracers appeared in GStreamer 1.8. Before, the timings are never
+ * gathered */
+#if GST_CHECK_VERSION (1, 8, 0)
+
+#define GST_TYPE_GZDEC_LATENCY_TRACER (gst_gzdec_latency_tracer_get_type ())
+
+typedef struct
+{
+  GstTracer parent;
+} GstGzdecLatencyTracer;
+
+typedef struct
+{
+  GstTracerClass parent_class;
+} GstGzdecLatencyTracerClass;
+
+GType gst_gzdec_latency_tracer_get_type (void);
+
+G_DEFINE_TYPE (GstGzdecLatencyTracer, gst_gzdec_latency_tracer,
+    GST_TYPE_TRACER);
+
+/* Tracer instances alive, the elements gather timings while there's one */
+static gint tracers = 0;
+static GstTracerRecord *record;
+
+static const gchar *phase_names[GST_GZDEC_N_PHASES] = {
+  "map", "allocate", "inflate", "push"
+};
+
+static void
+gst_gzdec_latency_tracer_finalize (GObject * object)
+{
+  g_atomic_int_add (&tracers, -1);
+
+  G_OBJECT_CLASS (gst_gzdec_latency_tracer_parent_class)->finalize (object);
+}
+
+static GstStructure *
+record_field (GType type, const gchar * description)
+{
+  return gst_structure_new ("value",
+      "type", G_TYPE_GTYPE, type,
+      "description", G_TYPE_STRING, description,
+      "flags", GST_TYPE_TRACER_VALUE_FLAGS,
+      GST_TRACER_VALUE_FLAGS_AGGREGATED, NULL);
+}
+
+static void
+gst_gzdec_latency_tracer_class_init (GstGzdecLatencyTracerClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_gzdec_latency_tracer_finalize;
+
+  record = gst_tracer_record_new ("gzdec-latency.class",
+      "element", GST_TYPE_STRUCTURE, gst_structure_new ("scope",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "related-to", GST_TYPE_TRACER_VALUE_SCOPE,
+          GST_TRACER_VALUE_SCOPE_ELEMENT, NULL),
+      "phase", GST_TYPE_STRUCTURE, record_field (G_TYPE_STRING,
+          "step of the buffer handling"),
+      "count", GST_TYPE_STRUCTURE, record_field (G_TYPE_UINT64,
+          "times the step was taken"),
+      "mean", GST_TYPE_STRUCTURE, record_field (G_TYPE_UINT64,
+          "mean time of the step in ns"),
+      "max", GST_TYPE_STRUCTURE, record_field (G_TYPE_UINT64,
+          "longest time of the step in ns"),
+      "histogram", GST_TYPE_STRUCTURE, record_field (G_TYPE_STRING,
+          "times taken by upper bound, in powers of two of microseconds"),
+      NULL);
+  GST_OBJECT_FLAG_SET (record, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+}
+
+static void
+gst_gzdec_latency_tracer_init (GstGzdecLatencyTracer * self)
+{
+  g_atomic_int_inc (&tracers);
+}
+
+gboolean
+gst_gzdec_latency_tracer_register (GstPlugin * plugin)
+{
+  return gst_tracer_register (plugin, "gzdec-latency",
+      GST_TYPE_GZDEC_LATENCY_TRACER);
+}
+
+gboolean
+gst_gzdec_latency_enabled (void)
+{
+  return g_atomic_int_get (&tracers) > 0;
+}
+
+/* Log the histogram of every step taken since the last report, and clear
+ * them */
+void
+gst_gzdec_latency_report (GstObject * element, GstGzdecLatency * latency)
+{
+  GstGzdecHistogram *hist;
+  GString *buckets;
+  gchar *name;
+  guint phase, i;
+
+  if (!record)
+    return;
+
+  name = gst_object_get_name (element);
+  buckets = g_string_new (NULL);
+  for (phase = 0; phase < GST_GZDEC_N_PHASES; phase++) {
+    hist = &latency->phases[phase];
+    if (hist->count == 0)
+      continue;
+
+    g_string_truncate (buckets, 0);
+    for (i = 0; i < GST_GZDEC_LATENCY_BUCKETS; i++) {
+      if (hist->buckets[i] == 0)
+        continue;
+      if (buckets->len > 0)
+        g_string_append_c (buckets, ' ');
+      if (i < GST_GZDEC_LATENCY_BUCKETS - 1)
+        g_string_append_printf (buckets, "<%uus:", 1u << i);
+      else
+        g_string_append_printf (buckets, ">=%uus:", 1u << (i - 1));
+      g_string_append_printf (buckets, "%" G_GUINT64_FORMAT,
+          hist->buckets[i]);
+    }
+
+    gst_tracer_record_log (record, name, phase_names[phase], hist->count,
+        hist->total / hist->count, hist->max, buckets->str);
+  }
+  g_string_free (buckets, TRUE);
+  g_free (name);
+
+  memset (latency, 0, sizeof (*latency));
+}
+
+#else
+
+gboolean
+gst_gzdec_latency_tracer_register (GstPlugin * plugin)
+{
+  return TRUE;
+}
+
+gboolean
+gst_gzdec_latency_enabled (void)
+{
+  return FALSE;
+}
+
+void
+gst_gzdec_latency_report (GstObject * element, GstGzdecLatency * latency)
+{
+}
+
+#endif
+
+void
+gst_gzdec_latency_add (GstGzdecLatency * latency, GstGzdecPhase phase,
+    GstClockTime time)
+{
+  GstGzdecHistogram *hist = &latency->phases[phase];
+  guint64 us = time / GST_USECOND;
+  guint bucket;
+
+  // The last bucket takes all the longer times
+  bucket = us > 0 ? MIN (g_bit_storage (us), GST_GZDEC_LATENCY_BUCKETS - 1)
+      : 0;
+
+  hist->count++;
+  hist->total += time;
+  hist->max = MAX (hist->max, time);
+  hist->buckets[bucket]++;
+}
@@ -0,0 +1,65 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_LATENCY_H_
+#define _GST_GZDEC_LATENCY_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Timing of the steps taken by gzdec on every buffer, gathered when the
+ * "gzdec-latency" tracer is loaded (GST_TRACERS=gzdec-latency) and logged
+ * by it as histograms at the end of every stream */
+typedef enum
+{
+  GST_GZDEC_PHASE_MAP,          /* mapping an input buffer */
+  GST_GZDEC_PHASE_ALLOCATE,     /* acquiring and mapping an output buffer */
+  GST_GZDEC_PHASE_INFLATE,      /* a backend uncompress step */
+  GST_GZDEC_PHASE_PUSH,         /* pushing an output buffer downstream */
+  GST_GZDEC_N_PHASES
+} GstGzdecPhase;
+
+/* Powers of two of microseconds: under 1 us, under 2 us, ... */
+#define GST_GZDEC_LATENCY_BUCKETS 24
+
+typedef struct
+{
+  guint64 count;
+  GstClockTime total;
+  GstClockTime max;
+  guint64 buckets[GST_GZDEC_LATENCY_BUCKETS];
+} GstGzdecHistogram;
+
+typedef struct
+{
+  GstGzdecHistogram phases[GST_GZDEC_N_PHASES];
+} GstGzdecLatency;
+
+gboolean gst_gzdec_latency_enabled (void);
+void gst_gzdec_latency_add (GstGzdecLatency * latency, GstGzdecPhase phase,
+    GstClockTime time);
+void gst_gzdec_latency_report (GstObject * element,
+    GstGzdecLatency * latency);
+
+gboolean gst_gzdec_latency_tracer_register (GstPlugin * plugin);
+
+G_END_DECLS
+
+#endif
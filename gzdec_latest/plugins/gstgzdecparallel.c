@@ -0,0 +1,917 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <bzlib.h>
+#include "gstgzdeczlib.h"
+#include "gstgzdecparallel.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_gzdec_parallel_debug);
+#define GST_CAT_DEFAULT gst_gzdec_parallel_debug
+
+/* bzip2 stream layout: "BZh" + block size digit, then blocks starting with
+ * BZ2_BLOCK_MAGIC + block CRC, and BZ2_EOS_MAGIC + combined CRC at the end.
+ * Blocks and the end marker are not byte aligned */
+#define BZ2_BLOCK_MAGIC     G_GUINT64_CONSTANT (0x314159265359)
+#define BZ2_EOS_MAGIC       G_GUINT64_CONSTANT (0x177245385090)
+#define BZ2_MAGIC_BITS      48
+#define BZ2_MAGIC_MASK      ((G_GUINT64_CONSTANT (1) << BZ2_MAGIC_BITS) - 1)
+#define BZ2_EOS_BITS        (BZ2_MAGIC_BITS + 32)
+#define BZ2_MAX_BLOCK_BITS  (G_GUINT64_CONSTANT (4 * 1024 * 1024) * 8)
+#define BZ2_MAX_MERGE       4
+
+/* gzip members are split at the next header found in the data, or using the
+ * block size of BGZF members. A chunk is decoded by a worker only when it
+ * holds exactly one member, otherwise it's inflated in order by the reader */
+#define GZ_HEADER_LEN       4
+#define GZ_BGZF_HEADER_LEN  18
+#define GZ_MAX_CHUNK        (4 * 1024 * 1024)
+#define GZ_MAX_MEMBER_OUT   (16 * 1024 * 1024)
+
+typedef enum
+{
+  JOB_BLOCK,
+  JOB_STREAM_END,
+  JOB_MEMBER
+} JobType;
+
+typedef struct
+{
+  JobType type;
+
+  /* Compressed data, only read by the workers */
+  guint8 *in;
+  gsize in_len;
+  guint shift;                  /* first bit of the block in in[0] */
+  guint64 nbits;
+  gchar level;
+  guint32 crc;                  /* block CRC, or combined CRC for stream ends */
+
+  /* Decoded data, owned by the worker until done is set */
+  GByteArray *out;
+  gsize out_pos;
+  gboolean done;
+  gboolean ok;
+
+  gboolean checked;
+  gboolean skip;                /* joined to a previous block */
+
+  /* gzip chunks not holding exactly one member are inflated by the reader */
+  gboolean sequential;
+  gsize in_pos;
+} Job;
+
+typedef enum
+{
+  STATE_HEADER,
+  STATE_BLOCKS,
+  STATE_DONE
+} ScanState;
+
+struct _GstGzdecParallel
+{
+  GstGzdecParallelFormat format;
+  gboolean multi_stream;
+  guint max_in_flight;
+  guint n_threads;
+
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+  GQueue jobs;                  /* in stream order, only used by the caller */
+
+  /* Input scanning. Positions are in bits from the start of in */
+  GByteArray *in;
+  guint64 scan_pos;
+  gint64 block_start;
+  ScanState state;
+  gchar level;
+  guint streams;
+  gboolean draining;
+  gboolean error;
+
+  guint32 combined_crc;
+
+  /* gzip chunking and in order inflating */
+  gsize chunk_start;
+  z_stream zstrm;
+  gboolean ended;
+};
+
+typedef enum
+{
+  CHECK_READ,                   /* the job data can be read */
+  CHECK_DROP,                   /* the job has nothing to read */
+  CHECK_WAIT,                   /* more input is needed to decide */
+  CHECK_ERROR
+} CheckResult;
+
+typedef struct
+{
+  guint8 *data;
+  guint64 pos;
+} BitWriter;
+
+static void worker_func (gpointer data, gpointer user_data);
+
+static guint32
+read_bits (const guint8 * data, guint64 pos, guint n)
+{
+  guint32 value = 0;
+
+  for (; n > 0; n--, pos++)
+    value = (value << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+
+  return value;
+}
+
+/* The writer data must be zero initialized */
+static void
+bit_writer_put (BitWriter * bw, guint64 value, guint n)
+{
+  while (n--) {
+    bw->data[bw->pos / 8] |= ((value >> n) & 1) << (7 - bw->pos % 8);
+    bw->pos++;
+  }
+}
+
+static void
+bit_writer_copy (BitWriter * bw, const guint8 * src, guint64 start,
+    guint64 nbits)
+{
+  const guint8 *p;
+  guint8 *dst;
+  guint shift;
+  guint64 nbytes, i;
+
+  // Whole bytes at once while the destination is byte aligned
+  if (bw->pos % 8 == 0) {
+    dst = bw->data + bw->pos / 8;
+    p = src + start / 8;
+    shift = start % 8;
+    nbytes = nbits / 8;
+
+    if (shift == 0) {
+      memcpy (dst, p, nbytes);
+    } else {
+      for (i = 0; i < nbytes; i++)
+        dst[i] = (p[i] << shift) | (p[i + 1] >> (8 - shift));
+    }
+
+    bw->pos += nbytes * 8;
+    start += nbytes * 8;
+    nbits -= nbytes * 8;
+  }
+
+  for (; nbits > 0; nbits--, start++)
+    bit_writer_put (bw, (src[start / 8] >> (7 - start % 8)) & 1, 1);
+}
+
+/* Look for the next block or end of stream magic starting at or after bit
+ * @from. Returns its bit position or -1 if not found in the data */
+static gint64
+bz2_find_magic (const guint8 * data, gsize len, guint64 from, gboolean * eos)
+{
+  guint64 reg = 0;
+  guint64 value;
+  gint64 start;
+  gsize i;
+  gint s;
+
+  for (i = from / 8; i < len; i++) {
+    reg = (reg << 8) | data[i];
+
+    // Candidates ending in this byte, from the earliest one
+    for (s = 7; s >= 0; s--) {
+      start = (gint64) (i + 1) * 8 - s - BZ2_MAGIC_BITS;
+      if (start < (gint64) from)
+        continue;
+
+      value = (reg >> s) & BZ2_MAGIC_MASK;
+      if (value == BZ2_BLOCK_MAGIC || value == BZ2_EOS_MAGIC) {
+        *eos = (value == BZ2_EOS_MAGIC);
+        return start;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/* Build a standalone single block bzip2 stream from one block, or from
+ * several ones joined together, and decode it */
+static gboolean
+bz2_decode (Job ** blocks, guint n, GByteArray * out)
+{
+  bz_stream strm;
+  BitWriter bw;
+  guint8 *stream;
+  guint64 nbits = 0;
+  gsize len, used = 0;
+  guint i;
+  int err;
+
+  for (i = 0; i < n; i++)
+    nbits += blocks[i]->nbits;
+
+  len = 4 + (nbits + BZ2_EOS_BITS + 7) / 8;
+  stream = g_malloc0 (len);
+  memcpy (stream, "BZh", 3);
+  stream[3] = blocks[0]->level;
+
+  bw.data = stream;
+  bw.pos = 32;
+  for (i = 0; i < n; i++)
+    bit_writer_copy (&bw, blocks[i]->in, blocks[i]->shift, blocks[i]->nbits);
+  // The combined CRC of a single block stream is the block CRC
+  bit_writer_put (&bw, BZ2_EOS_MAGIC, BZ2_MAGIC_BITS);
+  bit_writer_put (&bw, blocks[0]->crc, 32);
+
+  memset (&strm, 0, sizeof (strm));
+  if (BZ2_bzDecompressInit (&strm, 0, 0) != BZ_OK) {
+    g_free (stream);
+    return FALSE;
+  }
+
+  strm.next_in = (char *) stream;
+  strm.avail_in = len;
+  g_byte_array_set_size (out, (blocks[0]->level - '0') * 100000);
+
+  do {
+    if (used == out->len)
+      g_byte_array_set_size (out, out->len * 2);
+    strm.next_out = (char *) out->data + used;
+    strm.avail_out = out->len - used;
+    err = BZ2_bzDecompress (&strm);
+    used = out->len - strm.avail_out;
+  } while (err == BZ_OK && (strm.avail_in > 0 || strm.avail_out == 0));
+
+  BZ2_bzDecompressEnd (&strm);
+  g_free (stream);
+  g_byte_array_set_size (out, used);
+
+  return err == BZ_STREAM_END;
+}
+
+static void
+job_free (Job * job)
+{
+  g_free (job->in);
+  if (job->out)
+    g_byte_array_unref (job->out);
+  g_slice_free (Job, job);
+}
+
+/* Queue a job, and hand it to the workers unless there is nothing to decode */
+static void
+submit (GstGzdecParallel * par, Job * job, gboolean decode)
+{
+  g_queue_push_tail (&par->jobs, job);
+
+  if (!decode) {
+    job->done = TRUE;
+    job->ok = (job->type == JOB_STREAM_END);
+    return;
+  }
+
+  job->out = g_byte_array_new ();
+  g_thread_pool_push (par->pool, job, NULL);
+}
+
+static void
+bz2_submit_block (GstGzdecParallel * par, guint64 start, guint64 end)
+{
+  Job *job = g_slice_new0 (Job);
+  gsize first = start / 8;
+  gsize last = (end + 7) / 8;
+
+  job->type = JOB_BLOCK;
+  job->in_len = last - first;
+  job->in = g_malloc (job->in_len);
+  memcpy (job->in, par->in->data + first, job->in_len);
+  job->shift = start % 8;
+  job->nbits = end - start;
+  job->level = par->level;
+  job->crc = read_bits (job->in, job->shift + BZ2_MAGIC_BITS, 32);
+
+  GST_LOG ("Block of %" G_GUINT64_FORMAT " bits at bit %" G_GUINT64_FORMAT,
+      job->nbits, start);
+  submit (par, job, TRUE);
+}
+
+static void
+bz2_submit_stream_end (GstGzdecParallel * par, guint32 crc)
+{
+  Job *job = g_slice_new0 (Job);
+
+  job->type = JOB_STREAM_END;
+  job->crc = crc;
+  submit (par, job, FALSE);
+}
+
+/* Split the available input in blocks and hand them to the workers */
+static void
+bz2_dispatch (GstGzdecParallel * par)
+{
+  const guint8 *data;
+  guint64 avail;
+  gint64 magic;
+  gboolean eos;
+  gsize pos, keep;
+
+  while (!par->error && par->state != STATE_DONE
+      && par->jobs.length < par->max_in_flight) {
+    data = par->in->data;
+    avail = (guint64) par->in->len * 8;
+
+    if (par->state == STATE_HEADER) {
+      pos = par->scan_pos / 8;
+      if (par->in->len - pos < 4) {
+        if (par->draining) {
+          par->error = (par->streams == 0);
+          par->state = STATE_DONE;
+        }
+        break;
+      }
+
+      if (memcmp (data + pos, "BZh", 3) != 0 || data[pos + 3] < '1'
+          || data[pos + 3] > '9') {
+        if (par->streams == 0) {
+          GST_WARNING ("Invalid bzip2 header");
+          par->error = TRUE;
+        } else {
+          GST_WARNING ("Trailing garbage after %u streams ignored",
+              par->streams);
+        }
+        par->state = STATE_DONE;
+        break;
+      }
+
+      par->level = data[pos + 3];
+      par->scan_pos = (pos + 4) * 8;
+      par->block_start = -1;
+      par->state = STATE_BLOCKS;
+      continue;
+    }
+
+    magic = bz2_find_magic (data, par->in->len, par->scan_pos, &eos);
+    if (magic < 0 || (eos && magic + BZ2_EOS_BITS > avail)) {
+      // Don't look again at the positions already checked
+      if (magic < 0 && avail >= BZ2_MAGIC_BITS)
+        par->scan_pos = MAX (par->scan_pos, avail - BZ2_MAGIC_BITS + 1);
+
+      if (par->draining) {
+        GST_WARNING ("Truncated bzip2 stream");
+        par->error = TRUE;
+      } else if (par->block_start >= 0
+          && avail - par->block_start > BZ2_MAX_BLOCK_BITS) {
+        GST_WARNING ("No end found for block at bit %" G_GINT64_FORMAT,
+            par->block_start);
+        par->error = TRUE;
+      }
+      break;
+    }
+
+    if (par->block_start >= 0)
+      bz2_submit_block (par, par->block_start, magic);
+
+    if (eos) {
+      bz2_submit_stream_end (par, read_bits (data, magic + BZ2_MAGIC_BITS,
+              32));
+      par->streams++;
+      par->block_start = -1;
+      par->scan_pos = GST_ROUND_UP_8 (magic + BZ2_EOS_BITS);
+      par->state = par->multi_stream ? STATE_HEADER : STATE_DONE;
+    } else {
+      par->block_start = magic;
+      par->scan_pos = magic + BZ2_MAGIC_BITS;
+    }
+  }
+
+  // Drop the input already dispatched, only when it's worth the move
+  keep = (par->block_start >= 0 ? (guint64) par->block_start :
+      par->scan_pos) / 8;
+  if (keep > 0 && keep >= par->in->len / 2) {
+    g_byte_array_remove_range (par->in, 0, keep);
+    par->scan_pos -= keep * 8;
+    if (par->block_start >= 0)
+      par->block_start -= keep * 8;
+  }
+}
+
+/* A block failed to decode. The magic number ending it may be a false
+ * positive inside the compressed data, so retry joining it with the next
+ * blocks */
+static CheckResult
+bz2_merge (GstGzdecParallel * par, Job * job)
+{
+  Job *blocks[BZ2_MAX_MERGE + 1];
+  GList *l;
+  guint n = 1;
+  guint i;
+
+  blocks[0] = job;
+  for (l = par->jobs.head->next; l && n <= BZ2_MAX_MERGE; l = l->next) {
+    if (((Job *) l->data)->type != JOB_BLOCK)
+      break;
+
+    blocks[n++] = l->data;
+    if (bz2_decode (blocks, n, job->out)) {
+      GST_DEBUG ("Block decoded joined to %u more blocks", n - 1);
+      for (i = 1; i < n; i++)
+        blocks[i]->skip = TRUE;
+      job->ok = TRUE;
+      return CHECK_READ;
+    }
+  }
+
+  // Maybe the rest of the block is still to come
+  if (!l && n <= BZ2_MAX_MERGE && !par->draining
+      && par->state != STATE_DONE)
+    return CHECK_WAIT;
+
+  GST_WARNING ("Failed to decode block");
+  return CHECK_ERROR;
+}
+
+/* Validate a decoded job, in stream order, before its data is read */
+static CheckResult
+bz2_check (GstGzdecParallel * par, Job * job)
+{
+  CheckResult res;
+
+  if (job->skip)
+    return CHECK_DROP;
+
+  if (job->type == JOB_STREAM_END) {
+    if (job->crc != par->combined_crc) {
+      GST_WARNING ("Stream CRC mismatch");
+      return CHECK_ERROR;
+    }
+    par->combined_crc = 0;
+    return CHECK_DROP;
+  }
+
+  if (!job->ok) {
+    res = bz2_merge (par, job);
+    if (res != CHECK_READ)
+      return res;
+  }
+
+  par->combined_crc = ((par->combined_crc << 1) | (par->combined_crc >> 31))
+      ^ job->crc;
+
+  return CHECK_READ;
+}
+
+/* Whether a gzip member header (deflate, no reserved flags) starts at @data */
+static gboolean
+gz_is_header (const guint8 * data, gsize len)
+{
+  return len >= GZ_HEADER_LEN && data[0] == 0x1f && data[1] == 0x8b
+      && data[2] == Z_DEFLATED && (data[3] & 0xe0) == 0;
+}
+
+/* Size of the BGZF member starting at @data, or 0 if it isn't one */
+static gsize
+gz_bgzf_size (const guint8 * data, gsize len)
+{
+  if (len < GZ_BGZF_HEADER_LEN || !gz_is_header (data, len)
+      || !(data[3] & 0x04) || GST_READ_UINT16_LE (data + 10) < 6
+      || data[12] != 'B' || data[13] != 'C'
+      || GST_READ_UINT16_LE (data + 14) != 2)
+    return 0;
+
+  return GST_READ_UINT16_LE (data + 16) + 1;
+}
+
+/* Look for the next member header at or after byte @from. Returns its
+ * position or -1 if not found in the data */
+static gint64
+gz_find_header (const guint8 * data, gsize len, gsize from)
+{
+  const guint8 *p;
+
+  while (from < len) {
+    p = memchr (data + from, 0x1f, len - from);
+    if (!p)
+      break;
+
+    from = p - data;
+    if (gz_is_header (p, len - from))
+      return from;
+    from++;
+  }
+
+  return -1;
+}
+
+/* Inflate a chunk holding exactly one member. Members inflating to more
+ * than GZ_MAX_MEMBER_OUT are left to the reader, to bound the memory */
+static gboolean
+gz_decode (Job * job)
+{
+  z_stream strm;
+  gsize used = 0;
+  int err;
+
+  memset (&strm, 0, sizeof (strm));
+  if (inflateInit2 (&strm, MAX_WBITS + 16) != Z_OK)
+    return FALSE;
+
+  strm.next_in = job->in;
+  strm.avail_in = job->in_len;
+  g_byte_array_set_size (job->out, MIN (job->in_len * 4, GZ_MAX_MEMBER_OUT));
+
+  do {
+    if (used == job->out->len) {
+      if (job->out->len >= GZ_MAX_MEMBER_OUT)
+        break;
+      g_byte_array_set_size (job->out, MIN (job->out->len * 2,
+              GZ_MAX_MEMBER_OUT));
+    }
+    strm.next_out = job->out->data + used;
+    strm.avail_out = job->out->len - used;
+    err = inflate (&strm, Z_NO_FLUSH);
+    used = job->out->len - strm.avail_out;
+  } while (err == Z_OK);
+
+  inflateEnd (&strm);
+  g_byte_array_set_size (job->out, used);
+
+  return err == Z_STREAM_END && strm.avail_in == 0;
+}
+
+static void
+gz_submit_chunk (GstGzdecParallel * par, gsize start, gsize end)
+{
+  Job *job = g_slice_new0 (Job);
+
+  job->type = JOB_MEMBER;
+  job->in_len = end - start;
+  job->in = g_malloc (job->in_len);
+  memcpy (job->in, par->in->data + start, job->in_len);
+
+  GST_LOG ("Chunk of %" G_GSIZE_FORMAT " bytes at byte %" G_GSIZE_FORMAT,
+      job->in_len, start);
+  submit (par, job, gz_is_header (job->in, job->in_len));
+  par->chunk_start = end;
+}
+
+/* Split the available input in chunks and hand them to the workers */
+static void
+gz_dispatch (GstGzdecParallel * par)
+{
+  const guint8 *data;
+  gsize len, start, size;
+  gint64 next;
+
+  while (!par->error && par->state != STATE_DONE
+      && par->jobs.length < par->max_in_flight) {
+    data = par->in->data;
+    len = par->in->len;
+    start = par->chunk_start;
+
+    if (len == start) {
+      if (par->draining)
+        par->state = STATE_DONE;
+      break;
+    }
+    if (len - start < GZ_BGZF_HEADER_LEN && !par->draining)
+      break;
+
+    // BGZF members tell their own size
+    size = gz_bgzf_size (data + start, len - start);
+    if (size > 0) {
+      if (len - start < size && !par->draining)
+        break;
+      gz_submit_chunk (par, start, MIN (start + size, len));
+      continue;
+    }
+
+    next = gz_find_header (data, len, MAX (par->scan_pos, start + 1));
+    if (next >= 0) {
+      gz_submit_chunk (par, start, next);
+      continue;
+    }
+
+    // Don't look again at the positions already checked
+    par->scan_pos = MAX (start + 1, len - MIN (len, GZ_HEADER_LEN - 1));
+    if (par->draining)
+      gz_submit_chunk (par, start, len);
+    else if (len - start > GZ_MAX_CHUNK)
+      gz_submit_chunk (par, start, start + GZ_MAX_CHUNK);
+    else
+      break;
+  }
+
+  // Drop the input already dispatched, only when it's worth the move
+  if (par->chunk_start > 0 && par->chunk_start >= par->in->len / 2) {
+    g_byte_array_remove_range (par->in, 0, par->chunk_start);
+    par->scan_pos -= MIN (par->scan_pos, par->chunk_start);
+    par->chunk_start = 0;
+  }
+}
+
+/* Count a member, stopping at the first one for single member streams */
+static void
+gz_member_end (GstGzdecParallel * par)
+{
+  par->streams++;
+  if (!par->multi_stream) {
+    par->ended = TRUE;
+    par->state = STATE_DONE;
+  }
+}
+
+/* Use the worker result only if the chunk starts where the previous member
+ * ended, otherwise inflate it in order */
+static CheckResult
+gz_check (GstGzdecParallel * par, Job * job)
+{
+  if (par->zstrm.total_in == 0 && job->ok) {
+    gz_member_end (par);
+    return CHECK_READ;
+  }
+
+  GST_LOG ("Inflating chunk in order");
+  job->sequential = TRUE;
+  return CHECK_READ;
+}
+
+/* Inflate a chunk in the reader thread directly into @out. Sets @finished
+ * once the chunk input is consumed */
+static gboolean
+gz_inflate (GstGzdecParallel * par, Job * job, guint8 * out, gsize len,
+    gsize * written, gboolean * finished)
+{
+  z_stream *strm = &par->zstrm;
+  int err;
+
+  *finished = FALSE;
+  while (!*finished && *written < len) {
+    strm->next_in = job->in + job->in_pos;
+    strm->avail_in = job->in_len - job->in_pos;
+    strm->next_out = out + *written;
+    strm->avail_out = len - *written;
+    err = inflate (strm, Z_NO_FLUSH);
+    job->in_pos = job->in_len - strm->avail_in;
+    *written = len - strm->avail_out;
+
+    if (err == Z_STREAM_END) {
+      inflateReset (strm);
+      gz_member_end (par);
+      *finished = par->ended || job->in_pos == job->in_len;
+    } else if (err == Z_OK || err == Z_BUF_ERROR) {
+      *finished = strm->avail_in == 0 && strm->avail_out > 0;
+    } else if (par->streams > 0 && strm->total_out == 0) {
+      GST_WARNING ("Trailing garbage after %u members ignored", par->streams);
+      inflateReset (strm);
+      par->ended = TRUE;
+      par->state = STATE_DONE;
+      *finished = TRUE;
+    } else {
+      GST_WARNING ("Inflate error: %s", strm->msg ? strm->msg : zError (err));
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+dispatch (GstGzdecParallel * par)
+{
+  if (par->format == GST_GZDEC_PARALLEL_GZIP)
+    gz_dispatch (par);
+  else
+    bz2_dispatch (par);
+}
+
+static void
+worker_func (gpointer data, gpointer user_data)
+{
+  GstGzdecParallel *par = user_data;
+  Job *job = data;
+  gboolean ok;
+
+  if (job->type == JOB_MEMBER)
+    ok = gz_decode (job);
+  else
+    ok = bz2_decode (&job, 1, job->out);
+
+  g_mutex_lock (&par->lock);
+  job->ok = ok;
+  job->done = TRUE;
+  g_cond_broadcast (&par->cond);
+  g_mutex_unlock (&par->lock);
+}
+
+static void
+start (GstGzdecParallel * par)
+{
+  par->pool = g_thread_pool_new (worker_func, par, par->n_threads, FALSE,
+      NULL);
+  par->in = g_byte_array_new ();
+  par->scan_pos = 0;
+  par->block_start = -1;
+  par->state = STATE_HEADER;
+  par->level = '9';
+  par->streams = 0;
+  par->draining = FALSE;
+  par->error = FALSE;
+  par->combined_crc = 0;
+  par->chunk_start = 0;
+  par->ended = FALSE;
+  inflateInit2 (&par->zstrm, MAX_WBITS + 16);
+}
+
+static void
+stop (GstGzdecParallel * par)
+{
+  Job *job;
+
+  // Skip the queued jobs and wait for the running ones
+  g_thread_pool_free (par->pool, TRUE, TRUE);
+  par->pool = NULL;
+
+  while ((job = g_queue_pop_head (&par->jobs)))
+    job_free (job);
+  g_byte_array_unref (par->in);
+  par->in = NULL;
+  inflateEnd (&par->zstrm);
+}
+
+GstGzdecParallel *
+gst_gzdec_parallel_new (GstGzdecParallelFormat format, guint n_threads,
+    guint max_in_flight, gboolean multi_stream)
+{
+  GstGzdecParallel *par;
+
+  GST_DEBUG_CATEGORY_INIT (gst_gzdec_parallel_debug, "gzdecparallel", 0,
+      "gzdec parallel decoder");
+
+  par = g_new0 (GstGzdecParallel, 1);
+  par->format = format;
+  par->multi_stream = multi_stream;
+  par->n_threads = n_threads ? n_threads : g_get_num_processors ();
+  par->max_in_flight = max_in_flight ? max_in_flight : 2 * par->n_threads;
+  // Keep room to join blocks split by a false magic number
+  if (format == GST_GZDEC_PARALLEL_BZIP2)
+    par->max_in_flight = MAX (par->max_in_flight, BZ2_MAX_MERGE + 1);
+  g_mutex_init (&par->lock);
+  g_cond_init (&par->cond);
+  g_queue_init (&par->jobs);
+
+  GST_DEBUG ("%u threads, %u jobs in flight", par->n_threads,
+      par->max_in_flight);
+  start (par);
+
+  return par;
+}
+
+void
+gst_gzdec_parallel_free (GstGzdecParallel * par)
+{
+  stop (par);
+  g_mutex_clear (&par->lock);
+  g_cond_clear (&par->cond);
+  g_free (par);
+}
+
+/* Drop all the pending data and get ready for a new stream */
+void
+gst_gzdec_parallel_reset (GstGzdecParallel * par)
+{
+  stop (par);
+  start (par);
+}
+
+void
+gst_gzdec_parallel_push (GstGzdecParallel * par, const guint8 * data,
+    gsize len)
+{
+  if (par->state == STATE_DONE)
+    return;
+
+  g_byte_array_append (par->in, data, len);
+}
+
+/* No more input will come */
+void
+gst_gzdec_parallel_drain (GstGzdecParallel * par)
+{
+  par->draining = TRUE;
+}
+
+/* Read the decoded data in order. It returns OK when @out is full,
+ * NEED_INPUT when there is room for more input while the workers go on,
+ * and FINISHED at the end of the stream. It only blocks when the maximum
+ * number of jobs is in flight, or while draining */
+GstGzdecParallelResult
+gst_gzdec_parallel_read (GstGzdecParallel * par, guint8 * out, gsize len,
+    gsize * written)
+{
+  Job *job;
+  gsize n;
+  gboolean finished;
+  CheckResult res;
+
+  *written = 0;
+  dispatch (par);
+
+  while (*written < len) {
+    job = g_queue_peek_head (&par->jobs);
+    if (!job) {
+      if (par->error)
+        return GST_GZDEC_PARALLEL_ERROR;
+      if (par->format == GST_GZDEC_PARALLEL_GZIP
+          && par->state == STATE_DONE && !par->ended
+          && (par->zstrm.total_in > 0 || par->streams == 0)) {
+        GST_WARNING ("Truncated gzip stream");
+        par->error = TRUE;
+        return GST_GZDEC_PARALLEL_ERROR;
+      }
+      if (par->state == STATE_DONE)
+        return GST_GZDEC_PARALLEL_FINISHED;
+      if (par->draining)
+        return GST_GZDEC_PARALLEL_ERROR;
+      return GST_GZDEC_PARALLEL_NEED_INPUT;
+    }
+
+    g_mutex_lock (&par->lock);
+    if (!job->done && !par->draining && !par->error
+        && par->state != STATE_DONE
+        && par->jobs.length < par->max_in_flight) {
+      g_mutex_unlock (&par->lock);
+      return GST_GZDEC_PARALLEL_NEED_INPUT;
+    }
+    while (!job->done)
+      g_cond_wait (&par->cond, &par->lock);
+    g_mutex_unlock (&par->lock);
+
+    if (!job->checked) {
+      if (par->ended)
+        res = CHECK_DROP;
+      else if (job->type == JOB_MEMBER)
+        res = gz_check (par, job);
+      else
+        res = bz2_check (par, job);
+
+      switch (res) {
+        case CHECK_READ:
+          job->checked = TRUE;
+          break;
+        case CHECK_DROP:
+          break;
+        case CHECK_WAIT:
+          return GST_GZDEC_PARALLEL_NEED_INPUT;
+        case CHECK_ERROR:
+          par->error = TRUE;
+          return GST_GZDEC_PARALLEL_ERROR;
+      }
+    }
+
+    if (job->sequential) {
+      if (!gz_inflate (par, job, out, len, written, &finished)) {
+        par->error = TRUE;
+        return GST_GZDEC_PARALLEL_ERROR;
+      }
+      if (!finished)
+        continue;
+    } else if (job->checked) {
+      n = MIN (len - *written, job->out->len - job->out_pos);
+      memcpy (out + *written, job->out->data + job->out_pos, n);
+      job->out_pos += n;
+      *written += n;
+      if (job->out_pos < job->out->len)
+        continue;
+    }
+
+    g_queue_pop_head (&par->jobs);
+    job_free (job);
+    dispatch (par);
+  }
+
+  return GST_GZDEC_PARALLEL_OK;
+}
@@ -0,0 +1,59 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_PARALLEL_H_
+#define _GST_GZDEC_PARALLEL_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Parallel decoder: the compressed input is split in independent chunks
+ * (bzip2 blocks or gzip members) that are decoded by a pool of worker
+ * threads. The decoded data is read back in the original order */
+typedef struct _GstGzdecParallel GstGzdecParallel;
+
+typedef enum
+{
+  GST_GZDEC_PARALLEL_BZIP2,
+  GST_GZDEC_PARALLEL_GZIP
+} GstGzdecParallelFormat;
+
+typedef enum
+{
+  GST_GZDEC_PARALLEL_OK,
+  GST_GZDEC_PARALLEL_NEED_INPUT,
+  GST_GZDEC_PARALLEL_FINISHED,
+  GST_GZDEC_PARALLEL_ERROR
+} GstGzdecParallelResult;
+
+GstGzdecParallel *gst_gzdec_parallel_new (GstGzdecParallelFormat format,
+    guint n_threads, guint max_in_flight, gboolean multi_stream);
+void gst_gzdec_parallel_free (GstGzdecParallel * par);
+void gst_gzdec_parallel_reset (GstGzdecParallel * par);
+
+void gst_gzdec_parallel_push (GstGzdecParallel * par, const guint8 * data,
+    gsize len);
+void gst_gzdec_parallel_drain (GstGzdecParallel * par);
+GstGzdecParallelResult gst_gzdec_parallel_read (GstGzdecParallel * par,
+    guint8 * out, gsize len, gsize * written);
+
+G_END_DECLS
+
+#endif
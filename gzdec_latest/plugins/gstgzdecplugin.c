@@ -45,13 +45,82 @@
 #include <config.h>
 #endif
 
+#include <string.h>
 #include <gst/gst.h>
 #include "gstgzdec.h"
+#include "gstgzenc.h"
+#include "gstgzdeclatency.h"
+
+/* Bytes inflated to confirm a zlib header */
+#define ZLIB_TYPE_FIND_SIZE 4096
+
+/* zlib streams have no typefinder in the base plugins (gzip and bzip2 do).
+ * Their two byte header is weak, so the first bytes must also inflate */
+static void
+zlib_type_find (GstTypeFind * tf, gpointer unused)
+{
+  const guint8 *data;
+  guint8 out[16384];
+  z_stream strm;
+  guint size;
+  int err;
+
+  data = gst_type_find_peek (tf, 0, 2);
+  if (!data || (data[0] & 0x0f) != 8 || (data[0] >> 4) > 7
+      || (data[1] & 0x20) || ((data[0] << 8) | data[1]) % 31 != 0)
+    return;
+
+  // Short streams only have a few bytes to peek
+  for (size = ZLIB_TYPE_FIND_SIZE; size > 2; size /= 2) {
+    data = gst_type_find_peek (tf, 0, size);
+    if (data)
+      break;
+  }
+  if (size == 2)
+    data = gst_type_find_peek (tf, 0, size);
+
+  memset (&strm, 0, sizeof (strm));
+  if (inflateInit (&strm) != Z_OK)
+    return;
+  strm.next_in = (Bytef *) data;
+  strm.avail_in = size;
+  do {
+    strm.next_out = out;
+    strm.avail_out = sizeof (out);
+    err = inflate (&strm, Z_NO_FLUSH);
+  } while (err == Z_OK && strm.avail_in > 0);
+  inflateEnd (&strm);
+
+  if (err != Z_OK && err != Z_STREAM_END)
+    return;
+  gst_type_find_suggest_simple (tf, err == Z_STREAM_END || size >= 64 ?
+      GST_TYPE_FIND_LIKELY : GST_TYPE_FIND_POSSIBLE, "application/x-zlib",
+      NULL);
+}
+
+/* Neither is there one for LZ4 frames, whose magic number is enough */
+static void
+lz4_type_find (GstTypeFind * tf, gpointer unused)
+{
+  const guint8 *data;
+
+  data = gst_type_find_peek (tf, 0, 4);
+  if (data && GST_READ_UINT32_LE (data) == 0x184d2204)
+    gst_type_find_suggest_simple (tf, GST_TYPE_FIND_LIKELY,
+        "application/x-lz4", NULL);
+}
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
-  gst_element_register (plugin, "gzdec", GST_RANK_NONE, GST_TYPE_GZDEC);
+  // Marginal rank, so decodebin autoplugs it after the typefinders
+  gst_element_register (plugin, "gzdec", GST_RANK_MARGINAL, GST_TYPE_GZDEC);
+  gst_element_register (plugin, "gzenc", GST_RANK_NONE, GST_TYPE_GZENC);
+  gst_type_find_register (plugin, "application/x-zlib", GST_RANK_MARGINAL,
+      zlib_type_find, "zz,zlib", NULL, NULL, NULL);
+  gst_type_find_register (plugin, "application/x-lz4", GST_RANK_MARGINAL,
+      lz4_type_find, "lz4", NULL, NULL, NULL);
+  gst_gzdec_latency_tracer_register (plugin);
 
   return TRUE;
 }
@@ -60,7 +129,7 @@ GST_PLUGIN_DEFINE (
     GST_VERSION_MAJOR,
     GST_VERSION_MINOR,
     gzdec,
-    "gzdec plugin for gzip/bzip stream decompression",
+    "gzdec plugin for gzip/bzip stream compression and decompression",
     plugin_init,
     VERSION,
     "LGPL",
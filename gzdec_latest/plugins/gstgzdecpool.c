@@ -0,0 +1,119 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstgzdecpool.h"
+
+/* A pooled state, and the arena memory it holds when allocated from it */
+typedef struct
+{
+  z_stream strm;
+  GstGzdecArenaUsage usage;
+} PoolState;
+
+/* Idle states, most recently released first, their windows being the most
+ * likely to still be in cache. The second list has the arena states */
+G_LOCK_DEFINE_STATIC (pool);
+static GSList *pool[2] = { NULL, NULL };
+static guint pool_len = 0;
+
+/* An inflate state for a new stream, taken from the pool and reset for
+ * @window_bits, or a new one. With @usage, its memory comes from the arena
+ * and is counted there until released. NULL when zlib fails to allocate
+ * it */
+z_stream *
+gst_gzdec_pool_acquire (int window_bits, GstGzdecArenaUsage * usage)
+{
+  PoolState *state = NULL;
+  z_stream *strm;
+  guint arena = usage != NULL;
+
+  G_LOCK (pool);
+  if (pool[arena]) {
+    state = pool[arena]->data;
+    pool[arena] = g_slist_delete_link (pool[arena], pool[arena]);
+    pool_len--;
+  }
+  G_UNLOCK (pool);
+
+  if (!state)
+    state = g_new0 (PoolState, 1);
+  strm = &state->strm;
+  if (usage)
+    gst_gzdec_arena_attach (&state->usage, usage);
+
+  if (strm->state) {
+    if (inflateReset2 (strm, window_bits) == Z_OK)
+      return strm;
+    inflateEnd (strm);
+  }
+
+  memset (strm, 0, sizeof (z_stream));
+  if (usage) {
+    strm->zalloc = gst_gzdec_arena_zalloc;
+    strm->zfree = gst_gzdec_arena_zfree;
+    strm->opaque = &state->usage;
+  }
+  if (inflateInit2 (strm, window_bits) != Z_OK) {
+    if (usage)
+      gst_gzdec_arena_detach (&state->usage);
+    g_free (state);
+    return NULL;
+  }
+  return strm;
+}
+
+/* Give back a state acquired before, freed when the pool is full */
+void
+gst_gzdec_pool_release (z_stream * strm)
+{
+  PoolState *state = (PoolState *) strm;
+  guint arena;
+
+  if (!strm)
+    return;
+
+  arena = strm->opaque != NULL;
+  if (arena)
+    gst_gzdec_arena_detach (&state->usage);
+
+  // Don't keep pointers to the buffers of the last stream
+  strm->next_in = Z_NULL;
+  strm->avail_in = 0;
+  strm->next_out = Z_NULL;
+  strm->avail_out = 0;
+
+  G_LOCK (pool);
+  if (pool_len < GST_GZDEC_POOL_MAX) {
+    pool[arena] = g_slist_prepend (pool[arena], state);
+    pool_len++;
+    state = NULL;
+  }
+  G_UNLOCK (pool);
+
+  if (state) {
+    inflateEnd (strm);
+    g_free (state);
+  }
+}
@@ -0,0 +1,42 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_POOL_H_
+#define _GST_GZDEC_POOL_H_
+
+#include <gst/gst.h>
+
+#include "gstgzdeczlib.h"
+#include "gstgzdecarena.h"
+
+G_BEGIN_DECLS
+
+/* Process wide pool of inflate states. A stream takes one reset for its
+ * wrapper instead of allocating and initializing its own, and gives it back
+ * at its end for the next stream of any gzdec. States allocated from the
+ * arena are kept apart */
+#define GST_GZDEC_POOL_MAX 64
+
+z_stream *gst_gzdec_pool_acquire (int window_bits,
+    GstGzdecArenaUsage * usage);
+void gst_gzdec_pool_release (z_stream * strm);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,57 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZDEC_ZLIB_H_
+#define _GST_GZDEC_ZLIB_H_
+
+/* The zlib API used by the plugin. When configured with zlib-ng, its native
+ * (zng_ prefixed) interface is mapped to the zlib names, so the SIMD inflate
+ * is used without replacing the system zlib */
+#ifdef HAVE_ZLIB_NG
+
+#include <stdint.h>
+#include <zlib-ng.h>
+
+typedef zng_stream z_stream;
+typedef uint8_t Bytef;
+typedef uint32_t uInt;
+
+#define inflateInit           zng_inflateInit
+#define inflateInit2          zng_inflateInit2
+#define inflate               zng_inflate
+#define inflateEnd            zng_inflateEnd
+#define inflateReset          zng_inflateReset
+#define inflateReset2         zng_inflateReset2
+#define inflatePrime          zng_inflatePrime
+#define inflateSetDictionary  zng_inflateSetDictionary
+#define inflateGetDictionary  zng_inflateGetDictionary
+#define deflateInit2          zng_deflateInit2
+#define deflate               zng_deflate
+#define deflateEnd            zng_deflateEnd
+#define deflateBound          zng_deflateBound
+#define crc32                 zng_crc32
+#define zError                zng_zError
+
+#else
+
+#include <zlib.h>
+
+#endif
+
+#endif
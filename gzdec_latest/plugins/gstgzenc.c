@@ -0,0 +1,727 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+/**
+ * SECTION:element-gstgzenc
+ *
+ * The gzenc element compresses a stream into gzip or bzip2
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 filesrc location=file.txt ! gzenc level=9 ! filesink location=file.txt.gz
+ * ]|
+ * This pipeline compresses the file file.txt into file.txt.gz
+ *
+ * |[
+ * gst-launch-1.0 filesrc location=file.txt ! gzenc threads=0 ! filesink location=file.txt.gz
+ * ]|
+ * Like pigz, chunks of the input are compressed by one thread per CPU into
+ * independent gzip members, concatenated in the original order
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <gst/gst.h>
+#include "gstgzenc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_gzenc_debug);
+#define GST_CAT_DEFAULT gst_gzenc_debug
+
+/* prototypes */
+
+
+static void gst_gzenc_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_gzenc_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_gzenc_finalize (GObject * object);
+static void gst_gzenc_state_changed (GstElement * element, GstState oldstate,
+    GstState newstate, GstState pending);
+
+static GstFlowReturn gst_gzenc_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer);
+static gboolean gst_gzenc_event (GstPad * pad, GstObject * parent,
+    GstEvent * event);
+
+enum
+{
+  PROP_0,
+  PROP_FORMAT,
+  PROP_LEVEL,
+  PROP_STRATEGY,
+  PROP_THREADS,
+  PROP_CHUNK_SIZE
+};
+
+#define DEFAULT_FORMAT              GST_GZENC_FORMAT_GZIP
+#define DEFAULT_LEVEL               6
+#define DEFAULT_STRATEGY            GST_GZENC_STRATEGY_DEFAULT
+#define DEFAULT_THREADS             1
+#define DEFAULT_CHUNK_SIZE          (128 * 1024)
+
+/* Output buffers of the sequential encoder */
+#define OUT_BUFFER_SIZE             (64 * 1024)
+
+/* pad templates */
+
+static GstStaticPadTemplate sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY
+    );
+
+static GstStaticPadTemplate src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("application/x-gzip; application/x-bzip")
+    );
+
+#define gst_gzenc_parent_class parent_class
+G_DEFINE_TYPE (GstGzenc, gst_gzenc, GST_TYPE_ELEMENT);
+
+GType
+gst_gzenc_format_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_GZENC_FORMAT_GZIP, "gzip", "gzip"},
+    {GST_GZENC_FORMAT_BZIP2, "bzip2", "bzip2"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstGzencFormat", values);
+    g_once_init_leave (&type, tmp);
+  }
+
+  return type;
+}
+
+GType
+gst_gzenc_strategy_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue values[] = {
+    {GST_GZENC_STRATEGY_DEFAULT, "Normal data", "default"},
+    {GST_GZENC_STRATEGY_FILTERED, "Filtered data, small random values",
+        "filtered"},
+    {GST_GZENC_STRATEGY_HUFFMAN_ONLY, "Huffman coding only",
+        "huffman-only"},
+    {GST_GZENC_STRATEGY_RLE, "Run length matches only", "rle"},
+    {GST_GZENC_STRATEGY_FIXED, "Fixed Huffman codes", "fixed"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType tmp = g_enum_register_static ("GstGzencStrategy", values);
+    g_once_init_leave (&type, tmp);
+  }
+
+  return type;
+}
+
+/* zlib values of GstGzencStrategy */
+static const int zlib_strategies[] = {
+  Z_DEFAULT_STRATEGY,
+  Z_FILTERED,
+  Z_HUFFMAN_ONLY,
+  Z_RLE,
+  Z_FIXED
+};
+
+/* A chunk of the input compressed by the pool into one member */
+typedef struct
+{
+  GByteArray *in;
+  GByteArray *out;
+  guint level;
+  GstGzencStrategy strategy;
+  GstGzencFormat format;
+
+  /* Set by the worker, under the lock */
+  gboolean done;
+  gboolean ok;
+} Job;
+
+static void worker_func (gpointer data, gpointer user_data);
+static gboolean start (GstGzenc * gzenc);
+static void stop (GstGzenc * gzenc);
+static GstFlowReturn finish (GstGzenc * gzenc);
+
+static void
+gst_gzenc_class_init (GstGzencClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_gzenc_debug, "gzenc", 0, "gzenc element");
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "gzip encoder", "Codec/Encoder", "gzip/bzip2 encoder",
+      "Carlos Falgueras García <carlosfg@riseup.net");
+
+  gst_element_class_add_static_pad_template (gstelement_class, &sink_template);
+  gst_element_class_add_static_pad_template (gstelement_class, &src_template);
+
+  gobject_class->set_property = gst_gzenc_set_property;
+  gobject_class->get_property = gst_gzenc_get_property;
+  gobject_class->finalize = gst_gzenc_finalize;
+  gstelement_class->state_changed = gst_gzenc_state_changed;
+
+  g_object_class_install_property (gobject_class, PROP_FORMAT,
+      g_param_spec_enum ("format", "Format",
+          "Compressed format of the output", GST_TYPE_GZENC_FORMAT,
+          DEFAULT_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LEVEL,
+      g_param_spec_uint ("level", "Level",
+          "Compression level, 0 stores gzip data uncompressed. bzip2 uses "
+          "it as the block size in units of 100 kB, 1 at least",
+          0, 9, DEFAULT_LEVEL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STRATEGY,
+      g_param_spec_enum ("strategy", "Strategy",
+          "zlib compression strategy, tuned for the kind of data (gzip "
+          "only)", GST_TYPE_GZENC_STRATEGY, DEFAULT_STRATEGY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_uint ("threads", "Threads",
+          "Number of threads compressing chunks of the input in parallel, "
+          "each one into its own gzip member or bzip2 stream (0 = one per "
+          "CPU, 1 = a single member compressed in the streaming thread)",
+          0, G_MAXINT, DEFAULT_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHUNK_SIZE,
+      g_param_spec_uint ("chunk-size", "Chunk size",
+          "Bytes of input compressed into each member by the threads. "
+          "bzip2 chunks hold one whole block at least",
+          4096, G_MAXINT, DEFAULT_CHUNK_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_gzenc_init (GstGzenc * gzenc)
+{
+  /* sinkpad */
+  gzenc->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (gzenc->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_gzenc_chain));
+  gst_pad_set_event_function (gzenc->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_gzenc_event));
+  gst_element_add_pad (GST_ELEMENT (gzenc), gzenc->sinkpad);
+
+  /* srcpad */
+  gzenc->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_use_fixed_caps (gzenc->srcpad);
+  gst_element_add_pad (GST_ELEMENT (gzenc), gzenc->srcpad);
+
+  gzenc->format = DEFAULT_FORMAT;
+  gzenc->level = DEFAULT_LEVEL;
+  gzenc->strategy = DEFAULT_STRATEGY;
+  gzenc->threads = DEFAULT_THREADS;
+  gzenc->chunk_size = DEFAULT_CHUNK_SIZE;
+
+  gzenc->started = FALSE;
+  gzenc->offset = 0;
+
+  gzenc->pool = NULL;
+  g_mutex_init (&gzenc->lock);
+  g_cond_init (&gzenc->cond);
+  g_queue_init (&gzenc->jobs);
+  gzenc->chunk = NULL;
+  gzenc->members = 0;
+}
+
+void
+gst_gzenc_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstGzenc *gzenc = GST_GZENC (object);
+
+  GST_DEBUG_OBJECT (gzenc, "set_property");
+
+  GST_OBJECT_LOCK (gzenc);
+  switch (property_id) {
+    case PROP_FORMAT:
+      gzenc->format = g_value_get_enum (value);
+      break;
+    case PROP_LEVEL:
+      gzenc->level = g_value_get_uint (value);
+      break;
+    case PROP_STRATEGY:
+      gzenc->strategy = g_value_get_enum (value);
+      break;
+    case PROP_THREADS:
+      gzenc->threads = g_value_get_uint (value);
+      break;
+    case PROP_CHUNK_SIZE:
+      gzenc->chunk_size = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (gzenc);
+}
+
+void
+gst_gzenc_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstGzenc *gzenc = GST_GZENC (object);
+
+  GST_DEBUG_OBJECT (gzenc, "get_property");
+
+  GST_OBJECT_LOCK (gzenc);
+  switch (property_id) {
+    case PROP_FORMAT:
+      g_value_set_enum (value, gzenc->format);
+      break;
+    case PROP_LEVEL:
+      g_value_set_uint (value, gzenc->level);
+      break;
+    case PROP_STRATEGY:
+      g_value_set_enum (value, gzenc->strategy);
+      break;
+    case PROP_THREADS:
+      g_value_set_uint (value, gzenc->threads);
+      break;
+    case PROP_CHUNK_SIZE:
+      g_value_set_uint (value, gzenc->chunk_size);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (gzenc);
+}
+
+static void
+gst_gzenc_finalize (GObject * object)
+{
+  GstGzenc *gzenc = GST_GZENC (object);
+
+  stop (gzenc);
+  g_mutex_clear (&gzenc->lock);
+  g_cond_clear (&gzenc->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_gzenc_state_changed (GstElement * element, GstState oldstate,
+    GstState newstate, GstState pending)
+{
+  GstGzenc *gzenc = GST_GZENC (element);
+
+  if (newstate <= GST_STATE_READY)
+    stop (gzenc);
+}
+
+static GstFlowReturn
+push (GstGzenc * gzenc, GstBuffer * buf)
+{
+  gsize size = gst_buffer_get_size (buf);
+
+  GST_BUFFER_OFFSET (buf) = gzenc->offset;
+  GST_BUFFER_OFFSET_END (buf) = gzenc->offset + size;
+  gzenc->offset += size;
+
+  GST_DEBUG_OBJECT (gzenc, "Pushing %" G_GSIZE_FORMAT " bytes", size);
+  return gst_pad_push (gzenc->srcpad, buf);
+}
+
+/* Sequential encoding: compress the data into as many output buffers as
+ * needed. The encoder keeps part of the data, flushed only when finishing */
+static GstFlowReturn
+encode (GstGzenc * gzenc, guint8 * data, gsize len, gboolean finishing)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *buf;
+  GstMapInfo map;
+  gboolean gzip = gzenc->stream_format == GST_GZENC_FORMAT_GZIP;
+  gboolean ok, done;
+  gsize size;
+  int err;
+
+  if (gzip) {
+    gzenc->zstrm.next_in = data;
+    gzenc->zstrm.avail_in = len;
+  } else {
+    gzenc->bzstrm.next_in = (char *) data;
+    gzenc->bzstrm.avail_in = len;
+  }
+
+  do {
+    buf = gst_buffer_new_allocate (NULL, OUT_BUFFER_SIZE, NULL);
+    if (!gst_buffer_map (buf, &map, GST_MAP_WRITE)) {
+      gst_buffer_unref (buf);
+      return GST_FLOW_ERROR;
+    }
+
+    if (gzip) {
+      gzenc->zstrm.next_out = map.data;
+      gzenc->zstrm.avail_out = map.size;
+      err = deflate (&gzenc->zstrm, finishing ? Z_FINISH : Z_NO_FLUSH);
+      ok = err == Z_OK || err == Z_STREAM_END || err == Z_BUF_ERROR;
+      done = finishing ? err == Z_STREAM_END
+          : gzenc->zstrm.avail_in == 0 && gzenc->zstrm.avail_out > 0;
+      size = map.size - gzenc->zstrm.avail_out;
+    } else {
+      gzenc->bzstrm.next_out = (char *) map.data;
+      gzenc->bzstrm.avail_out = map.size;
+      err = BZ2_bzCompress (&gzenc->bzstrm, finishing ? BZ_FINISH : BZ_RUN);
+      // BZ_RUN without input nor pending output is a parameter error
+      ok = err == BZ_RUN_OK || err == BZ_FINISH_OK || err == BZ_STREAM_END
+          || (err == BZ_PARAM_ERROR && !finishing
+          && gzenc->bzstrm.avail_in == 0);
+      done = finishing ? err == BZ_STREAM_END
+          : gzenc->bzstrm.avail_in == 0 && gzenc->bzstrm.avail_out > 0;
+      size = map.size - gzenc->bzstrm.avail_out;
+    }
+    gst_buffer_unmap (buf, &map);
+
+    if (!ok) {
+      GST_DEBUG_OBJECT (gzenc, "Compress error: %d", err);
+      gst_buffer_unref (buf);
+      return GST_FLOW_ERROR;
+    }
+
+    if (size > 0) {
+      gst_buffer_set_size (buf, size);
+      ret = push (gzenc, buf);
+    } else {
+      gst_buffer_unref (buf);
+    }
+  } while (ret == GST_FLOW_OK && !done);
+
+  return ret;
+}
+
+/* Compress a whole chunk into a gzip member or bzip2 stream */
+static gboolean
+compress_chunk (Job * job)
+{
+  z_stream strm;
+  guint size;
+  int err;
+
+  if (job->format == GST_GZENC_FORMAT_BZIP2) {
+    size = job->in->len + job->in->len / 100 + 600;
+    g_byte_array_set_size (job->out, size);
+    err = BZ2_bzBuffToBuffCompress ((char *) job->out->data, &size,
+        (char *) job->in->data, job->in->len, MAX (job->level, 1), 0, 0);
+    g_byte_array_set_size (job->out, size);
+    return err == BZ_OK;
+  }
+
+  memset (&strm, 0, sizeof (strm));
+  if (deflateInit2 (&strm, job->level, Z_DEFLATED, 31, 8,
+          zlib_strategies[job->strategy]) != Z_OK)
+    return FALSE;
+
+  g_byte_array_set_size (job->out, deflateBound (&strm, job->in->len));
+  strm.next_in = job->in->data;
+  strm.avail_in = job->in->len;
+  strm.next_out = job->out->data;
+  strm.avail_out = job->out->len;
+  err = deflate (&strm, Z_FINISH);
+  g_byte_array_set_size (job->out, strm.total_out);
+  deflateEnd (&strm);
+
+  return err == Z_STREAM_END;
+}
+
+static void
+worker_func (gpointer data, gpointer user_data)
+{
+  GstGzenc *gzenc = user_data;
+  Job *job = data;
+  gboolean ok;
+
+  ok = compress_chunk (job);
+
+  g_mutex_lock (&gzenc->lock);
+  job->ok = ok;
+  job->done = TRUE;
+  g_cond_broadcast (&gzenc->cond);
+  g_mutex_unlock (&gzenc->lock);
+}
+
+static void
+job_free (Job * job)
+{
+  if (job->in)
+    g_byte_array_unref (job->in);
+  if (job->out)
+    g_byte_array_unref (job->out);
+  g_free (job);
+}
+
+/* Push the compressed members in order. Unless @all is set, only wait for
+ * the oldest one while too many are in flight */
+static GstFlowReturn
+push_jobs (GstGzenc * gzenc, gboolean all)
+{
+  GstFlowReturn ret;
+  GstBuffer *buf;
+  Job *job;
+  gboolean done;
+  gsize size;
+
+  while ((job = g_queue_peek_head (&gzenc->jobs))) {
+    g_mutex_lock (&gzenc->lock);
+    while (!job->done && (all
+            || g_queue_get_length (&gzenc->jobs) > gzenc->max_in_flight))
+      g_cond_wait (&gzenc->cond, &gzenc->lock);
+    done = job->done;
+    g_mutex_unlock (&gzenc->lock);
+
+    if (!done)
+      break;
+
+    g_queue_pop_head (&gzenc->jobs);
+    if (!job->ok) {
+      job_free (job);
+      return GST_FLOW_ERROR;
+    }
+
+    size = job->out->len;
+    buf = gst_buffer_new_wrapped (g_byte_array_free (job->out, FALSE), size);
+    job->out = NULL;
+    job_free (job);
+
+    ret = push (gzenc, buf);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Hand the current chunk to the pool, and push the members already done */
+static GstFlowReturn
+submit_chunk (GstGzenc * gzenc)
+{
+  Job *job;
+
+  job = g_new0 (Job, 1);
+  job->in = gzenc->chunk ? gzenc->chunk : g_byte_array_new ();
+  job->out = g_byte_array_new ();
+  job->format = gzenc->stream_format;
+  GST_OBJECT_LOCK (gzenc);
+  job->level = gzenc->level;
+  job->strategy = gzenc->strategy;
+  GST_OBJECT_UNLOCK (gzenc);
+  gzenc->chunk = NULL;
+
+  GST_DEBUG_OBJECT (gzenc, "Member %u, %u bytes", gzenc->members,
+      job->in->len);
+  gzenc->members++;
+  g_queue_push_tail (&gzenc->jobs, job);
+  g_thread_pool_push (gzenc->pool, job, NULL);
+
+  return push_jobs (gzenc, FALSE);
+}
+
+static gboolean
+start (GstGzenc * gzenc)
+{
+  GstCaps *caps;
+  GstSegment segment;
+  guint level, threads, chunk_size;
+  GstGzencStrategy strategy;
+  int err;
+
+  GST_OBJECT_LOCK (gzenc);
+  gzenc->stream_format = gzenc->format;
+  level = gzenc->level;
+  strategy = gzenc->strategy;
+  threads = gzenc->threads;
+  chunk_size = gzenc->chunk_size;
+  GST_OBJECT_UNLOCK (gzenc);
+
+  if (threads != 1) {
+    threads = threads ? threads : g_get_num_processors ();
+    gzenc->pool = g_thread_pool_new (worker_func, gzenc, threads, FALSE,
+        NULL);
+    if (!gzenc->pool)
+      return FALSE;
+    gzenc->max_in_flight = 2 * threads;
+    // A bzip2 chunk smaller than a block wastes the block sorting
+    gzenc->job_size = chunk_size;
+    if (gzenc->stream_format == GST_GZENC_FORMAT_BZIP2)
+      gzenc->job_size = MAX (chunk_size, MAX (level, 1) * 100000);
+    GST_DEBUG_OBJECT (gzenc, "%u threads, chunks of %" G_GSIZE_FORMAT
+        " bytes", threads, gzenc->job_size);
+  } else if (gzenc->stream_format == GST_GZENC_FORMAT_GZIP) {
+    memset (&gzenc->zstrm, 0, sizeof (gzenc->zstrm));
+    err = deflateInit2 (&gzenc->zstrm, level, Z_DEFLATED, 31, 8,
+        zlib_strategies[strategy]);
+    if (err != Z_OK)
+      return FALSE;
+  } else {
+    memset (&gzenc->bzstrm, 0, sizeof (gzenc->bzstrm));
+    err = BZ2_bzCompressInit (&gzenc->bzstrm, MAX (level, 1), 0, 0);
+    if (err != BZ_OK)
+      return FALSE;
+  }
+  gzenc->started = TRUE;
+  gzenc->offset = 0;
+  gzenc->members = 0;
+
+  caps = gst_caps_new_empty_simple (gzenc->stream_format ==
+      GST_GZENC_FORMAT_GZIP ? "application/x-gzip" : "application/x-bzip");
+  gst_pad_push_event (gzenc->srcpad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  gst_pad_push_event (gzenc->srcpad, gst_event_new_segment (&segment));
+
+  return TRUE;
+}
+
+static void
+stop (GstGzenc * gzenc)
+{
+  Job *job;
+
+  if (!gzenc->started)
+    return;
+
+  if (gzenc->pool) {
+    // Drop the queued chunks, and wait for the ones being compressed
+    g_thread_pool_free (gzenc->pool, TRUE, TRUE);
+    gzenc->pool = NULL;
+    while ((job = g_queue_pop_head (&gzenc->jobs)))
+      job_free (job);
+    if (gzenc->chunk) {
+      g_byte_array_unref (gzenc->chunk);
+      gzenc->chunk = NULL;
+    }
+  } else if (gzenc->stream_format == GST_GZENC_FORMAT_GZIP) {
+    deflateEnd (&gzenc->zstrm);
+  } else {
+    BZ2_bzCompressEnd (&gzenc->bzstrm);
+  }
+  gzenc->started = FALSE;
+}
+
+/* Compress what is left and close the stream */
+static GstFlowReturn
+finish (GstGzenc * gzenc)
+{
+  GstFlowReturn ret;
+
+  if (!gzenc->pool)
+    return encode (gzenc, NULL, 0, TRUE);
+
+  // An empty input still gets one (empty) member
+  if (gzenc->chunk || gzenc->members == 0) {
+    ret = submit_chunk (gzenc);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  return push_jobs (gzenc, TRUE);
+}
+
+static GstFlowReturn
+gst_gzenc_chain (GstPad * pad, GstObject * parent, GstBuffer * in_buf)
+{
+  GstGzenc *gzenc = GST_GZENC (parent);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstMapInfo in_buf_map;
+  guint8 *data;
+  gsize len, n;
+
+  if (!gzenc->started && !start (gzenc)) {
+    GST_ELEMENT_ERROR (gzenc, LIBRARY, INIT, (NULL),
+        ("Failed to initialize the encoder"));
+    gst_buffer_unref (in_buf);
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_buffer_map (in_buf, &in_buf_map, GST_MAP_READ)) {
+    gst_buffer_unref (in_buf);
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gzenc->pool) {
+    if (in_buf_map.size > 0)
+      ret = encode (gzenc, in_buf_map.data, in_buf_map.size, FALSE);
+  } else {
+    // Fill the chunks straight from the input
+    data = in_buf_map.data;
+    len = in_buf_map.size;
+    while (len > 0 && ret == GST_FLOW_OK) {
+      if (!gzenc->chunk)
+        gzenc->chunk = g_byte_array_sized_new (gzenc->job_size);
+      n = MIN (len, gzenc->job_size - gzenc->chunk->len);
+      g_byte_array_append (gzenc->chunk, data, n);
+      data += n;
+      len -= n;
+      if (gzenc->chunk->len == gzenc->job_size)
+        ret = submit_chunk (gzenc);
+    }
+  }
+
+  if (ret == GST_FLOW_ERROR)
+    GST_ELEMENT_ERROR (gzenc, STREAM, ENCODE, (NULL),
+        ("Failed to compress the data"));
+
+  gst_buffer_unmap (in_buf, &in_buf_map);
+  gst_buffer_unref (in_buf);
+  return ret;
+}
+
+static gboolean
+gst_gzenc_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstGzenc *gzenc = GST_GZENC (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:
+    case GST_EVENT_SEGMENT:
+      // Both describe the uncompressed data, ours are sent on start
+      gst_event_unref (event);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      // Start a new stream with the next buffer
+      stop (gzenc);
+      break;
+    case GST_EVENT_EOS:
+      // Even an empty input is a valid stream
+      if (!gzenc->started && !start (gzenc)) {
+        GST_ELEMENT_ERROR (gzenc, LIBRARY, INIT, (NULL),
+            ("Failed to initialize the encoder"));
+        break;
+      }
+      if (finish (gzenc) == GST_FLOW_ERROR)
+        GST_ELEMENT_ERROR (gzenc, STREAM, ENCODE, (NULL),
+            ("Failed to compress the end of the stream"));
+      break;
+  };
+
+  return gst_pad_event_default (pad, parent, event);
+}
@@ -0,0 +1,124 @@
+/* GStreamer
+ * Copyright (C) 2021 Carlos Falgueras García <carlosfg@riseup.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_GZENC_H_
+#define _GST_GZENC_H_
+
+#include <gst/gst.h>
+#include <bzlib.h>
+
+#include "gstgzdeczlib.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_GZENC          (gst_gzenc_get_type ())
+#define GST_GZENC(obj)          (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_GZENC, GstGzenc))
+#define GST_GZENC_CLASS(klass)  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_GZENC, GstGzencClass))
+#define GST_IS_GZENC(obj)       (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_GZENC))
+#define GST_IS_GZENC_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_GZENC))
+
+typedef struct _GstGzenc GstGzenc;
+typedef struct _GstGzencClass GstGzencClass;
+
+/**
+ * GstGzencFormat:
+ * @GST_GZENC_FORMAT_GZIP: gzip (RFC 1952)
+ * @GST_GZENC_FORMAT_BZIP2: bzip2
+ *
+ * Compressed format of the output.
+ */
+typedef enum
+{
+  GST_GZENC_FORMAT_GZIP,
+  GST_GZENC_FORMAT_BZIP2
+} GstGzencFormat;
+
+#define GST_TYPE_GZENC_FORMAT (gst_gzenc_format_get_type ())
+GType gst_gzenc_format_get_type (void);
+
+/**
+ * GstGzencStrategy:
+ * @GST_GZENC_STRATEGY_DEFAULT: normal data
+ * @GST_GZENC_STRATEGY_FILTERED: data produced by a filter or predictor,
+ *   made of small values with a somewhat random distribution
+ * @GST_GZENC_STRATEGY_HUFFMAN_ONLY: Huffman coding only, no string matching
+ * @GST_GZENC_STRATEGY_RLE: string matching limited to run lengths
+ * @GST_GZENC_STRATEGY_FIXED: no dynamic Huffman codes
+ *
+ * zlib compression strategy, only used for gzip.
+ */
+typedef enum
+{
+  GST_GZENC_STRATEGY_DEFAULT,
+  GST_GZENC_STRATEGY_FILTERED,
+  GST_GZENC_STRATEGY_HUFFMAN_ONLY,
+  GST_GZENC_STRATEGY_RLE,
+  GST_GZENC_STRATEGY_FIXED
+} GstGzencStrategy;
+
+#define GST_TYPE_GZENC_STRATEGY (gst_gzenc_strategy_get_type ())
+GType gst_gzenc_strategy_get_type (void);
+
+struct _GstGzenc
+{
+  GstElement element;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  GstGzencFormat format;
+  guint level;
+  GstGzencStrategy strategy;
+  guint threads;
+  guint chunk_size;
+
+  /* Set on the first buffer, from the properties */
+  gboolean started;
+  GstGzencFormat stream_format;
+  guint64 offset;               /* bytes pushed */
+
+  /* Sequential encoding, a single gzip member or bzip2 stream */
+  union
+  {
+    z_stream zstrm;
+    bz_stream bzstrm;
+  };
+
+  /* Threaded encoding. Chunks of the input are compressed as independent
+   * members by the pool and pushed in order */
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+  GQueue jobs;
+  GByteArray *chunk;
+  gsize job_size;
+  guint max_in_flight;
+  guint members;
+};
+
+struct _GstGzencClass
+{
+  GstElementClass parent_class;
+};
+
+GType gst_gzenc_get_type (void);
+
+G_END_DECLS
+
+#endif